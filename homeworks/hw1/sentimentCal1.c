@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,11 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <ctype.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -48,11 +54,324 @@ int count_word_in_line(const char *line, const char *word)
     return count;
 }
 
+// Worker placement: with --pin every worker is pinned to one core, spreading workers across NUMA nodes
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+int pin_workers = 0;
+int cpu_order[MAX_CPUS];
+int cpu_node[MAX_CPUS];
+int cpu_count = 0;
+
+// Function to build the CPU order so that consecutive workers alternate between NUMA nodes
+void build_cpu_order(void)
+{
+    int node_of_cpu[MAX_CPUS];
+    int num_nodes = 0;
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        node_of_cpu[cpu] = CPU_ISSET(cpu, &allowed) ? 0 : -1;
+    }
+
+    // Read the CPU list of every NUMA node from sysfs, e.g. "0-3,8-11"
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (!file)
+        {
+            break;
+        }
+        int first, last;
+        char separator;
+        while (fscanf(file, "%d", &first) == 1)
+        {
+            last = first;
+            if (fscanf(file, "%c", &separator) == 1 && separator == '-')
+            {
+                fscanf(file, "%d%c", &last, &separator);
+            }
+            for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++)
+            {
+                if (node_of_cpu[cpu] >= 0)
+                {
+                    node_of_cpu[cpu] = node;
+                }
+            }
+        }
+        fclose(file);
+        num_nodes++;
+    }
+    if (num_nodes == 0)
+    {
+        num_nodes = 1;
+    }
+
+    // Interleave the nodes: first CPU of node 0, first CPU of node 1, second CPU of node 0, ...
+    int cursor[MAX_NODES] = {0};
+    int added = 1;
+    while (added)
+    {
+        added = 0;
+        for (int node = 0; node < num_nodes; node++)
+        {
+            while (cursor[node] < MAX_CPUS && node_of_cpu[cursor[node]] != node)
+            {
+                cursor[node]++;
+            }
+            if (cursor[node] < MAX_CPUS)
+            {
+                cpu_order[cpu_count] = cursor[node]++;
+                cpu_node[cpu_count++] = node;
+                added = 1;
+            }
+        }
+    }
+}
+
+// Function to pin the calling worker to its core and prefer memory from that core's node
+void pin_current_worker(int worker_index)
+{
+    if (!pin_workers || cpu_count == 0)
+    {
+        return;
+    }
+
+    int slot = worker_index % cpu_count;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu_order[slot], &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
+    {
+        perror("sched_setaffinity failed");
+        return;
+    }
+
+    // Pages this worker touches first (input blocks, result records) now come from its own node
+    unsigned long node_mask = 1UL << cpu_node[slot];
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8);
+}
+
+// Function to strip the leading options from the argument list
+void parse_options(int *argc, char *argv[])
+{
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strcmp(argv[1], "--pin") == 0)
+        {
+            pin_workers = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++)
+        {
+            argv[i] = argv[i + 1];
+        }
+        (*argc)--;
+    }
+}
+
+// Readahead pipeline: a dedicated I/O thread fills blocks while the worker scores the previous one
+#define READAHEAD_BLOCK_SIZE (1024 * 1024)
+#define READAHEAD_BUFFERS 3
+
+// Struct to hold a block of the input file
+typedef struct
+{
+    char *data;
+    ssize_t length; // 0 at end of file, -1 on read error
+} ReadBlock;
+
+// Struct to hold the readahead state of a single worker
+typedef struct
+{
+    int fd;
+    ReadBlock blocks[READAHEAD_BUFFERS];
+    sem_t filled; // Blocks ready to be consumed by the worker
+    sem_t empty;  // Blocks ready to be refilled by the I/O thread
+    pthread_t io_thread;
+    volatile int stop;
+    ReadBlock *current;
+    int next_block;
+    size_t offset;
+    int eof;
+} ReadAhead;
+
+// Function run by the I/O thread: read the file block by block into the free buffers
+void *readahead_io_thread(void *arg)
+{
+    ReadAhead *ra = (ReadAhead *)arg;
+    off_t file_offset = 0;
+
+    for (int i = 0;; i = (i + 1) % READAHEAD_BUFFERS)
+    {
+        // Wait for the worker to hand back a buffer
+        sem_wait(&ra->empty);
+        if (ra->stop)
+        {
+            break;
+        }
+
+        // Fill the whole block so the worker sees as few hand-offs as possible
+        ReadBlock *block = &ra->blocks[i];
+        block->length = 0;
+        while (block->length < READAHEAD_BLOCK_SIZE)
+        {
+            ssize_t bytes_read = read(ra->fd, block->data + block->length, READAHEAD_BLOCK_SIZE - block->length);
+            if (bytes_read < 0)
+            {
+                block->length = -1;
+                break;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            block->length += bytes_read;
+        }
+        file_offset += block->length > 0 ? block->length : 0;
+
+        // Ask the kernel to start fetching the block after the next one
+        posix_fadvise(ra->fd, file_offset, READAHEAD_BLOCK_SIZE, POSIX_FADV_WILLNEED);
+
+        int done = block->length < READAHEAD_BLOCK_SIZE;
+        sem_post(&ra->filled);
+        if (done)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Function to open a file and start its readahead I/O thread
+int readahead_open(ReadAhead *ra, const char *filename)
+{
+    memset(ra, 0, sizeof(ReadAhead));
+    ra->fd = open(filename, O_RDONLY);
+    if (ra->fd < 0)
+    {
+        return -1;
+    }
+    posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (int i = 0; i < READAHEAD_BUFFERS; i++)
+    {
+        ra->blocks[i].data = malloc(READAHEAD_BLOCK_SIZE);
+        if (!ra->blocks[i].data)
+        {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // All buffers start empty, none are filled yet
+    sem_init(&ra->filled, 0, 0);
+    sem_init(&ra->empty, 0, READAHEAD_BUFFERS);
+    if (pthread_create(&ra->io_thread, NULL, readahead_io_thread, ra) != 0)
+    {
+        perror("Thread creation failed");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+// Function to read the next line from the readahead buffers with the same semantics as fgets
+char *readahead_gets(ReadAhead *ra, char *line, size_t size)
+{
+    size_t copied = 0;
+
+    while (copied < size - 1)
+    {
+        // Move to the next block once the current one is consumed
+        if (!ra->current || ra->offset == (size_t)ra->current->length)
+        {
+            if (ra->eof)
+            {
+                break;
+            }
+            if (ra->current)
+            {
+                sem_post(&ra->empty);
+            }
+            sem_wait(&ra->filled);
+            ra->current = &ra->blocks[ra->next_block];
+            ra->next_block = (ra->next_block + 1) % READAHEAD_BUFFERS;
+            ra->offset = 0;
+            if (ra->current->length < 0)
+            {
+                perror("Error reading file");
+            }
+            if (ra->current->length < READAHEAD_BLOCK_SIZE)
+            {
+                ra->eof = 1;
+            }
+            if (ra->current->length <= 0)
+            {
+                ra->current->length = 0;
+                break;
+            }
+        }
+
+        // Copy up to the end of the line, the end of the block or the end of the caller's buffer
+        const char *start = ra->current->data + ra->offset;
+        size_t available = ra->current->length - ra->offset;
+        if (available > size - 1 - copied)
+        {
+            available = size - 1 - copied;
+        }
+        const char *newline = memchr(start, '\n', available);
+        size_t length = newline ? (size_t)(newline - start) + 1 : available;
+        memcpy(line + copied, start, length);
+        copied += length;
+        ra->offset += length;
+        if (newline)
+        {
+            break;
+        }
+    }
+
+    if (copied == 0)
+    {
+        return NULL;
+    }
+    line[copied] = '\0';
+    return line;
+}
+
+// Function to stop the I/O thread and release the readahead buffers
+void readahead_close(ReadAhead *ra)
+{
+    // Wake the I/O thread in case it is waiting for a free buffer
+    ra->stop = 1;
+    sem_post(&ra->empty);
+    pthread_join(ra->io_thread, NULL);
+
+    sem_destroy(&ra->filled);
+    sem_destroy(&ra->empty);
+    for (int i = 0; i < READAHEAD_BUFFERS; i++)
+    {
+        free(ra->blocks[i].data);
+    }
+    close(ra->fd);
+}
+
 // Function to process a single file and write the result to a temporary output file
 void process_file(const char *input_file, const char *positive_word, const char *negative_word, const char *temp_output_file)
 {
-    FILE *inp_file = fopen(input_file, "r");
-    if (!inp_file)
+    ReadAhead inp_file;
+    if (readahead_open(&inp_file, input_file) != 0)
     {
         fprintf(stderr, "Error while opening file: %s\n", input_file);
         exit(1);
@@ -62,14 +381,14 @@ void process_file(const char *input_file, const char *positive_word, const char
     if (!out_file)
     {
         fprintf(stderr, "Error while opening temp output file: %s\n", temp_output_file);
-        fclose(inp_file);
+        readahead_close(&inp_file);
         exit(1);
     }
 
     char line[MAX_LINE_LENGTH];
     int line_number = 1;
     int total_sentiment = 0;
-    while (fgets(line, sizeof(line), inp_file))
+    while (readahead_gets(&inp_file, line, sizeof(line)))
     {
         // Calculate sentiment score for the line
         int num_positive = count_word_in_line(line, positive_word);
@@ -87,7 +406,7 @@ void process_file(const char *input_file, const char *positive_word, const char
 
     printf("Total sentiment score for %s: %d\n", input_file, total_sentiment);
 
-    fclose(inp_file);
+    readahead_close(&inp_file);
     fclose(out_file);
     exit(0);
 }
@@ -132,9 +451,10 @@ void combine_results(int n, const char *output_file)
 
 int main(int argc, char *argv[])
 {
+    parse_options(&argc, argv);
     if (argc < 5)
     {
-        fprintf(stderr, "Usage: %s <positive_word> <negative_word> <num_files> <file1> <file2> ... <output_file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--pin] <positive_word> <negative_word> <num_files> <file1> <file2> ... <output_file>\n", argv[0]);
         exit(1);
     }
 
@@ -152,6 +472,12 @@ int main(int argc, char *argv[])
     int n = atoi(argv[3]);
     const char *output_file = argv[argc - 1];
 
+    // Work out the core each child will be pinned to
+    if (pin_workers)
+    {
+        build_cpu_order();
+    }
+
     // Create child processes for each input file
     for (int i = 0; i < n; i++)
     {
@@ -167,6 +493,8 @@ int main(int argc, char *argv[])
         // Child process
         if (pid == 0)
         {
+            pin_current_worker(i);
+
             // Generate a temporary output file for this child and process the input file
             char temp_output_filename[MAX_FILENAME_LENGTH];
             snprintf(temp_output_filename, sizeof(temp_output_filename), "task1_temp_output_%d.txt", i);
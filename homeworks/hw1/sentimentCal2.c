@@ -1,17 +1,23 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <semaphore.h>
 #include <time.h>
 #include <ctype.h>
+#include <sched.h>
+#include <sys/syscall.h>
 
 #define MAX_LINE_LENGTH 1024
 #define MAX_FILE_COUNT 10
 #define SHARED_MEM_SIZE (1024 * 1024 * 500)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define CHUNK_LINES 1024
 
 // Struct to hold each line's information
 typedef struct
@@ -21,12 +27,32 @@ typedef struct
     char line[MAX_LINE_LENGTH];
 } MmapData;
 
-// Shared memory structure to hold results
+// Struct to hold a fixed-size block of lines, chained into the result slot of one file
 typedef struct
 {
-    MmapData lines[SHARED_MEM_SIZE / sizeof(MmapData)];
+    MmapData lines[CHUNK_LINES];
     int line_count;
-    sem_t semaphore;
+    int next_chunk; // Index of the next chunk of the same slot, -1 for the last one
+} ResultChunk;
+
+// Struct to hold the chain of chunks written by the child processing one file
+typedef struct
+{
+    int first_chunk;
+    int last_chunk;
+    int chunk_count;
+    int max_chunks; // Share of --mem-budget in chunks, 0 for unlimited
+    int spilled;    // Set once earlier lines were written to the slot's run file
+} ResultSlot;
+
+#define NUM_CHUNKS (SHARED_MEM_SIZE / sizeof(ResultChunk))
+
+// Shared memory structure to hold results: one slot per input file, indexed by argv position
+typedef struct
+{
+    ResultChunk chunks[NUM_CHUNKS];
+    int chunks_used; // Chunks are claimed with an atomic add, the only shared write
+    ResultSlot slots[MAX_FILE_COUNT];
 } SharedMemory;
 
 // Function to check if a character is a word boundary by checking if the character is an alphabet or not
@@ -60,28 +86,448 @@ int count_word_in_line(const char *line, const char *word)
     return count;
 }
 
-// Compare function for sorting the MmapData array
-int compare_lines(const void *a, const void *b)
+// Worker placement: with --pin every worker is pinned to one core, spreading workers across NUMA nodes
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+int pin_workers = 0;
+long long mem_budget = 0; // Bytes of shared chunks all children may fill before spilling, 0 for unlimited
+int use_huge_pages = 0;
+int cpu_order[MAX_CPUS];
+int cpu_node[MAX_CPUS];
+int cpu_count = 0;
+
+// Function to build the CPU order so that consecutive workers alternate between NUMA nodes
+void build_cpu_order(void)
+{
+    int node_of_cpu[MAX_CPUS];
+    int num_nodes = 0;
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        node_of_cpu[cpu] = CPU_ISSET(cpu, &allowed) ? 0 : -1;
+    }
+
+    // Read the CPU list of every NUMA node from sysfs, e.g. "0-3,8-11"
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (!file)
+        {
+            break;
+        }
+        int first, last;
+        char separator;
+        while (fscanf(file, "%d", &first) == 1)
+        {
+            last = first;
+            if (fscanf(file, "%c", &separator) == 1 && separator == '-')
+            {
+                fscanf(file, "%d%c", &last, &separator);
+            }
+            for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++)
+            {
+                if (node_of_cpu[cpu] >= 0)
+                {
+                    node_of_cpu[cpu] = node;
+                }
+            }
+        }
+        fclose(file);
+        num_nodes++;
+    }
+    if (num_nodes == 0)
+    {
+        num_nodes = 1;
+    }
+
+    // Interleave the nodes: first CPU of node 0, first CPU of node 1, second CPU of node 0, ...
+    int cursor[MAX_NODES] = {0};
+    int added = 1;
+    while (added)
+    {
+        added = 0;
+        for (int node = 0; node < num_nodes; node++)
+        {
+            while (cursor[node] < MAX_CPUS && node_of_cpu[cursor[node]] != node)
+            {
+                cursor[node]++;
+            }
+            if (cursor[node] < MAX_CPUS)
+            {
+                cpu_order[cpu_count] = cursor[node]++;
+                cpu_node[cpu_count++] = node;
+                added = 1;
+            }
+        }
+    }
+}
+
+// Function to pin the calling worker to its core and prefer memory from that core's node
+void pin_current_worker(int worker_index)
 {
-    MmapData *line1 = (MmapData *)a;
-    MmapData *line2 = (MmapData *)b;
+    if (!pin_workers || cpu_count == 0)
+    {
+        return;
+    }
 
-    // Compare by filename
-    int filename_cmp = strcmp(line1->filename, line2->filename);
-    if (filename_cmp != 0)
+    int slot = worker_index % cpu_count;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu_order[slot], &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
     {
-        return filename_cmp;
+        perror("sched_setaffinity failed");
+        return;
     }
 
-    // If filenames are equal, compare by line number
-    return line1->line_number - line2->line_number;
+    // Pages this worker touches first (input blocks, result records) now come from its own node
+    unsigned long node_mask = 1UL << cpu_node[slot];
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8);
+}
+
+// Function to parse a size such as 512K, 64M or 2G into bytes
+long long parse_size(const char *text)
+{
+    char *end;
+    long long size = strtoll(text, &end, 10);
+    if (*end == 'k' || *end == 'K')
+    {
+        size <<= 10;
+    }
+    else if (*end == 'm' || *end == 'M')
+    {
+        size <<= 20;
+    }
+    else if (*end == 'g' || *end == 'G')
+    {
+        size <<= 30;
+    }
+    return size;
 }
 
-void process_file(const char *filename, const char *pos_word, const char *neg_word, SharedMemory *shm)
+// Function to strip the leading options from the argument list
+void parse_options(int *argc, char *argv[])
 {
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strcmp(argv[1], "--pin") == 0)
+        {
+            pin_workers = 1;
+        }
+        else if (strcmp(argv[1], "--hugepages") == 0)
+        {
+            use_huge_pages = 1;
+        }
+        else if (strncmp(argv[1], "--mem-budget=", 13) == 0)
+        {
+            mem_budget = parse_size(argv[1] + 13);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++)
+        {
+            argv[i] = argv[i + 1];
+        }
+        (*argc)--;
+    }
+}
+
+// Readahead pipeline: a dedicated I/O thread fills blocks while the worker scores the previous one
+#define READAHEAD_BLOCK_SIZE (1024 * 1024)
+#define READAHEAD_BUFFERS 3
+
+// Struct to hold a block of the input file
+typedef struct
+{
+    char *data;
+    ssize_t length; // 0 at end of file, -1 on read error
+} ReadBlock;
+
+// Struct to hold the readahead state of a single worker
+typedef struct
+{
+    int fd;
+    ReadBlock blocks[READAHEAD_BUFFERS];
+    sem_t filled; // Blocks ready to be consumed by the worker
+    sem_t empty;  // Blocks ready to be refilled by the I/O thread
+    pthread_t io_thread;
+    volatile int stop;
+    ReadBlock *current;
+    int next_block;
+    size_t offset;
+    int eof;
+} ReadAhead;
+
+// Function run by the I/O thread: read the file block by block into the free buffers
+void *readahead_io_thread(void *arg)
+{
+    ReadAhead *ra = (ReadAhead *)arg;
+    off_t file_offset = 0;
+
+    for (int i = 0;; i = (i + 1) % READAHEAD_BUFFERS)
+    {
+        // Wait for the worker to hand back a buffer
+        sem_wait(&ra->empty);
+        if (ra->stop)
+        {
+            break;
+        }
+
+        // Fill the whole block so the worker sees as few hand-offs as possible
+        ReadBlock *block = &ra->blocks[i];
+        block->length = 0;
+        while (block->length < READAHEAD_BLOCK_SIZE)
+        {
+            ssize_t bytes_read = read(ra->fd, block->data + block->length, READAHEAD_BLOCK_SIZE - block->length);
+            if (bytes_read < 0)
+            {
+                block->length = -1;
+                break;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            block->length += bytes_read;
+        }
+        file_offset += block->length > 0 ? block->length : 0;
+
+        // Ask the kernel to start fetching the block after the next one
+        posix_fadvise(ra->fd, file_offset, READAHEAD_BLOCK_SIZE, POSIX_FADV_WILLNEED);
+
+        int done = block->length < READAHEAD_BLOCK_SIZE;
+        sem_post(&ra->filled);
+        if (done)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Function to open a file and start its readahead I/O thread
+int readahead_open(ReadAhead *ra, const char *filename)
+{
+    memset(ra, 0, sizeof(ReadAhead));
+    ra->fd = open(filename, O_RDONLY);
+    if (ra->fd < 0)
+    {
+        return -1;
+    }
+    posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (int i = 0; i < READAHEAD_BUFFERS; i++)
+    {
+        ra->blocks[i].data = malloc(READAHEAD_BLOCK_SIZE);
+        if (!ra->blocks[i].data)
+        {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // All buffers start empty, none are filled yet
+    sem_init(&ra->filled, 0, 0);
+    sem_init(&ra->empty, 0, READAHEAD_BUFFERS);
+    if (pthread_create(&ra->io_thread, NULL, readahead_io_thread, ra) != 0)
+    {
+        perror("Thread creation failed");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+// Function to read the next line from the readahead buffers with the same semantics as fgets
+char *readahead_gets(ReadAhead *ra, char *line, size_t size)
+{
+    size_t copied = 0;
+
+    while (copied < size - 1)
+    {
+        // Move to the next block once the current one is consumed
+        if (!ra->current || ra->offset == (size_t)ra->current->length)
+        {
+            if (ra->eof)
+            {
+                break;
+            }
+            if (ra->current)
+            {
+                sem_post(&ra->empty);
+            }
+            sem_wait(&ra->filled);
+            ra->current = &ra->blocks[ra->next_block];
+            ra->next_block = (ra->next_block + 1) % READAHEAD_BUFFERS;
+            ra->offset = 0;
+            if (ra->current->length < 0)
+            {
+                perror("Error reading file");
+            }
+            if (ra->current->length < READAHEAD_BLOCK_SIZE)
+            {
+                ra->eof = 1;
+            }
+            if (ra->current->length <= 0)
+            {
+                ra->current->length = 0;
+                break;
+            }
+        }
+
+        // Copy up to the end of the line, the end of the block or the end of the caller's buffer
+        const char *start = ra->current->data + ra->offset;
+        size_t available = ra->current->length - ra->offset;
+        if (available > size - 1 - copied)
+        {
+            available = size - 1 - copied;
+        }
+        const char *newline = memchr(start, '\n', available);
+        size_t length = newline ? (size_t)(newline - start) + 1 : available;
+        memcpy(line + copied, start, length);
+        copied += length;
+        ra->offset += length;
+        if (newline)
+        {
+            break;
+        }
+    }
+
+    if (copied == 0)
+    {
+        return NULL;
+    }
+    line[copied] = '\0';
+    return line;
+}
+
+// Function to stop the I/O thread and release the readahead buffers
+void readahead_close(ReadAhead *ra)
+{
+    // Wake the I/O thread in case it is waiting for a free buffer
+    ra->stop = 1;
+    sem_post(&ra->empty);
+    pthread_join(ra->io_thread, NULL);
+
+    sem_destroy(&ra->filled);
+    sem_destroy(&ra->empty);
+    for (int i = 0; i < READAHEAD_BUFFERS; i++)
+    {
+        free(ra->blocks[i].data);
+    }
+    close(ra->fd);
+}
+
+// Function to write the lines of a chain of chunks to a file in the output format
+void write_chunks(FILE *file, SharedMemory *shm, int first_chunk)
+{
+    for (int c = first_chunk; c >= 0; c = shm->chunks[c].next_chunk)
+    {
+        ResultChunk *chunk = &shm->chunks[c];
+        for (int j = 0; j < chunk->line_count; j++)
+        {
+            fprintf(file, "%s, %d: %s",
+                    chunk->lines[j].filename,
+                    chunk->lines[j].line_number,
+                    chunk->lines[j].line);
+        }
+    }
+}
+
+// Function to get the name of the run file a slot spills to
+void run_filename(char *filename, size_t size, int slot_index)
+{
+    snprintf(filename, size, "task2_run_%d.txt", slot_index);
+}
+
+// Function to spill the chunks of a slot to its run file so that the chunks can be refilled
+void spill_slot(SharedMemory *shm, ResultSlot *slot, int slot_index)
+{
+    char filename[64];
+    run_filename(filename, sizeof(filename), slot_index);
+    FILE *run_file = fopen(filename, slot->spilled ? "a" : "w");
+    if (!run_file)
+    {
+        perror("Error opening run file");
+        exit(EXIT_FAILURE);
+    }
+
+    // Lines only ever arrive in file order, so every spill extends the same ordered run
+    write_chunks(run_file, shm, slot->first_chunk);
+    fclose(run_file);
+    slot->spilled = 1;
+
+    // Empty the chain and start refilling it from its first chunk
+    for (int c = slot->first_chunk; c >= 0; c = shm->chunks[c].next_chunk)
+    {
+        shm->chunks[c].line_count = 0;
+    }
+    slot->last_chunk = slot->first_chunk;
+}
+
+// Function to get room for one more line in the result slot, claiming a new chunk when the last one is full
+MmapData *claim_line(SharedMemory *shm, ResultSlot *slot, int slot_index)
+{
+    // Reuse the already linked chunks of a spilled chain before claiming anything new
+    while (slot->last_chunk >= 0 && shm->chunks[slot->last_chunk].line_count == CHUNK_LINES &&
+           shm->chunks[slot->last_chunk].next_chunk >= 0)
+    {
+        slot->last_chunk = shm->chunks[slot->last_chunk].next_chunk;
+    }
+
+    // At the budget, spill instead of growing the chain
+    if (slot->last_chunk >= 0 && shm->chunks[slot->last_chunk].line_count == CHUNK_LINES &&
+        slot->max_chunks && slot->chunk_count >= slot->max_chunks)
+    {
+        spill_slot(shm, slot, slot_index);
+    }
+
+    if (slot->last_chunk < 0 || shm->chunks[slot->last_chunk].line_count == CHUNK_LINES)
+    {
+        int chunk_index = __atomic_fetch_add(&shm->chunks_used, 1, __ATOMIC_RELAXED);
+        if (chunk_index >= (int)NUM_CHUNKS)
+        {
+            return NULL;
+        }
+
+        // Link the new chunk at the end of this slot's chain
+        ResultChunk *chunk = &shm->chunks[chunk_index];
+        chunk->line_count = 0;
+        chunk->next_chunk = -1;
+        if (slot->last_chunk < 0)
+        {
+            slot->first_chunk = chunk_index;
+        }
+        else
+        {
+            shm->chunks[slot->last_chunk].next_chunk = chunk_index;
+        }
+        slot->last_chunk = chunk_index;
+        slot->chunk_count++;
+    }
+
+    ResultChunk *chunk = &shm->chunks[slot->last_chunk];
+    return &chunk->lines[chunk->line_count++];
+}
+
+void process_file(const char *filename, const char *pos_word, const char *neg_word, SharedMemory *shm, int slot_index)
+{
+    ResultSlot *slot = &shm->slots[slot_index];
+
     // Open the file
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    ReadAhead file;
+    if (readahead_open(&file, filename) != 0)
     {
         perror("Error opening file");
         exit(EXIT_FAILURE);
@@ -93,7 +539,7 @@ void process_file(const char *filename, const char *pos_word, const char *neg_wo
     int total_sentiment = 0;
 
     // Read the file line by line
-    while (fgets(line, sizeof(line), file))
+    while (readahead_gets(&file, line, sizeof(line)))
     {
         line_number++;
 
@@ -104,43 +550,65 @@ void process_file(const char *filename, const char *pos_word, const char *neg_wo
 
         if (sentiment_score != 0)
         {
-            // Write the line to shared memory
-            sem_wait(&shm->semaphore);
+            // Write the line to this file's own slot, lines arrive already in order
+            MmapData *new_line = claim_line(shm, slot, slot_index);
 
-            // Check if there is enough space in shared memory
-            if (shm->line_count < (SHARED_MEM_SIZE / sizeof(MmapData)))
-            {
-                // Add the line to shared memory
-                MmapData *new_line = &shm->lines[shm->line_count++];
-                strncpy(new_line->filename, filename, sizeof(new_line->filename) - 1);
-                new_line->line_number = line_number;
-                strncpy(new_line->line, line, sizeof(new_line->line) - 1);
-            }
             // If there is not enough space, print an error message and exit
-            else
+            if (!new_line)
             {
-                // Release the semaphore before exiting
                 fprintf(stderr, "Shared memory buffer overflow. Too many lines matched.\n");
-                sem_post(&shm->semaphore);
-                fclose(file);
+                readahead_close(&file);
                 exit(EXIT_FAILURE);
             }
-            // Release the semaphore
-            sem_post(&shm->semaphore);
+            strncpy(new_line->filename, filename, sizeof(new_line->filename) - 1);
+            new_line->line_number = line_number;
+            strncpy(new_line->line, line, sizeof(new_line->line) - 1);
             total_sentiment += sentiment_score;
         }
     }
 
     printf("Total sentiment score for %s: %d\n", filename, total_sentiment);
 
-    fclose(file);
+    readahead_close(&file);
+}
+
+// Function to map the shared result region, backed by huge pages when requested
+SharedMemory *map_shared_memory(size_t *mapped_size)
+{
+    size_t size = sizeof(SharedMemory);
+    if (use_huge_pages)
+    {
+        // Round up to whole huge pages and try the reserved hugetlbfs pool first
+        size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        SharedMemory *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region != MAP_FAILED)
+        {
+            *mapped_size = size;
+            return region;
+        }
+    }
+
+    SharedMemory *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+    {
+        return region;
+    }
+
+    // No hugetlbfs pages reserved: ask for transparent huge pages instead (needs shmem THP enabled)
+    if (use_huge_pages)
+    {
+        madvise(region, size, MADV_HUGEPAGE);
+    }
+    *mapped_size = size;
+    return region;
 }
 
 int main(int argc, char *argv[])
 {
+    parse_options(&argc, argv);
     if (argc < 5)
     {
-        fprintf(stderr, "Usage: %s <positive_word> <negative_word> <num_files> <input_files...> <output_file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--pin] [--hugepages] [--mem-budget=<size>] <positive_word> <negative_word> <num_files> <input_files...> <output_file>\n", argv[0]);
         return EXIT_FAILURE;
     }
     // Measure the start time
@@ -156,24 +624,51 @@ int main(int argc, char *argv[])
     const char *neg_word = argv[2];
     int num_files = atoi(argv[3]);
     char *output_file = argv[4 + num_files];
+    if (num_files > MAX_FILE_COUNT)
+    {
+        fprintf(stderr, "At most %d input files are supported\n", MAX_FILE_COUNT);
+        return EXIT_FAILURE;
+    }
+
+    // Work out the core each child will be pinned to
+    if (pin_workers)
+    {
+        build_cpu_order();
+    }
 
     /**
      * Set up shared memory with flags: MAP_SHARED | MAP_ANONYMOUS and PROT_READ | PROT_WRITE where
      * MAP_SHARED creates a shared mapping and
      * MAP_ANONYMOUS creates an anonymous mapping that is not backed by a file
      * PROT_READ | PROT_WRITE specifies that the memory can be read from and written to
+     * With --hugepages the region is backed by MAP_HUGETLB pages, or by THP when none are reserved
      **/
-    SharedMemory *shm = mmap(NULL, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    size_t shm_size;
+    SharedMemory *shm = map_shared_memory(&shm_size);
     if (shm == MAP_FAILED)
     {
         perror("mmap failed");
         return EXIT_FAILURE;
     }
 
-    // Zero-initialize shared memory and initialize unnamed semaphore
-    memset(shm, 0, sizeof(SharedMemory));
-    // Initialize the semaphore with a value of 1
-    sem_init(&shm->semaphore, 1, 1);
+    // Fresh anonymous pages are already zero, so the region is not memset: pages are only faulted
+    // in when a child writes a record, on the node of that child, and startup does not touch 500 MB
+    shm->chunks_used = 0;
+    for (int i = 0; i < num_files; i++)
+    {
+        shm->slots[i].first_chunk = -1;
+        shm->slots[i].last_chunk = -1;
+        shm->slots[i].chunk_count = 0;
+        shm->slots[i].spilled = 0;
+
+        // Every child gets an equal share of the budget, at least one chunk
+        shm->slots[i].max_chunks = 0;
+        if (mem_budget)
+        {
+            long long chunks = mem_budget / (long long)sizeof(ResultChunk) / num_files;
+            shm->slots[i].max_chunks = chunks > 0 ? (int)chunks : 1;
+        }
+    }
 
     // Create child processes for each input file
     pid_t pids[MAX_FILE_COUNT];
@@ -182,7 +677,8 @@ int main(int argc, char *argv[])
         if ((pids[i] = fork()) == 0)
         {
             // Child process
-            process_file(argv[4 + i], pos_word, neg_word, shm);
+            pin_current_worker(i);
+            process_file(argv[4 + i], pos_word, neg_word, shm, i);
             exit(0);
         }
     }
@@ -193,10 +689,7 @@ int main(int argc, char *argv[])
         waitpid(pids[i], NULL, 0);
     }
 
-    // Sort the results with compare_lines function via qsort
-    qsort(shm->lines, shm->line_count, sizeof(MmapData), compare_lines);
-
-    // Write sorted results to output file
+    // Write results to output file
     FILE *out_file = fopen(output_file, "w");
     if (!out_file)
     {
@@ -204,20 +697,36 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    // Write the sorted lines to the output file
-    for (int i = 0; i < shm->line_count; i++)
+    // Walk the slots in argv order, the output is deterministic without sorting.
+    // Each slot's spilled run precedes its in-memory lines, so the merge is a streaming copy
+    char buffer[64 * 1024];
+    for (int i = 0; i < num_files; i++)
     {
-        fprintf(out_file, "%s, %d: %s",
-                shm->lines[i].filename,
-                shm->lines[i].line_number,
-                shm->lines[i].line);
+        if (shm->slots[i].spilled)
+        {
+            char filename[64];
+            run_filename(filename, sizeof(filename), i);
+            FILE *run_file = fopen(filename, "r");
+            if (!run_file)
+            {
+                perror("Error opening run file");
+                return EXIT_FAILURE;
+            }
+            size_t bytes_read;
+            while ((bytes_read = fread(buffer, 1, sizeof(buffer), run_file)) > 0)
+            {
+                fwrite(buffer, 1, bytes_read, out_file);
+            }
+            fclose(run_file);
+            remove(filename);
+        }
+        write_chunks(out_file, shm, shm->slots[i].first_chunk);
     }
 
     fclose(out_file);
 
-    // Clean up: destroy the semaphore, unmap the shared memory
-    sem_destroy(&shm->semaphore);
-    munmap(shm, sizeof(SharedMemory));
+    // Clean up: unmap the shared memory
+    munmap(shm, shm_size);
 
     // Measure the end time and calculate the execution time
     clock_gettime(CLOCK_MONOTONIC, &end_time);
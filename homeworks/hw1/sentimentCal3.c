@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +6,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include <time.h>
 
 #define MAX_FILES 10
@@ -21,7 +24,143 @@ int is_standalone_word(const char *str, const char *word) {
     return 0;
 }
 
-void process_input_file(char *input_file, char *positive_word, char *negative_word, int pipe_fd) {
+// Worker placement: with --pin every worker is pinned to one core, spreading workers across NUMA nodes
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+int pin_workers = 0;
+long long mem_budget = 0; // Bytes of results buffered across all children before flushing, 0 for unlimited
+int cpu_order[MAX_CPUS];
+int cpu_node[MAX_CPUS];
+int cpu_count = 0;
+
+// Function to build the CPU order so that consecutive workers alternate between NUMA nodes
+void build_cpu_order(void) {
+    int node_of_cpu[MAX_CPUS];
+    int num_nodes = 0;
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        node_of_cpu[cpu] = CPU_ISSET(cpu, &allowed) ? 0 : -1;
+    }
+
+    // Read the CPU list of every NUMA node from sysfs, e.g. "0-3,8-11"
+    for (int node = 0; node < MAX_NODES; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (!file) {
+            break;
+        }
+        int first, last;
+        char separator;
+        while (fscanf(file, "%d", &first) == 1) {
+            last = first;
+            if (fscanf(file, "%c", &separator) == 1 && separator == '-') {
+                fscanf(file, "%d%c", &last, &separator);
+            }
+            for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) {
+                if (node_of_cpu[cpu] >= 0) {
+                    node_of_cpu[cpu] = node;
+                }
+            }
+        }
+        fclose(file);
+        num_nodes++;
+    }
+    if (num_nodes == 0) {
+        num_nodes = 1;
+    }
+
+    // Interleave the nodes: first CPU of node 0, first CPU of node 1, second CPU of node 0, ...
+    int cursor[MAX_NODES] = {0};
+    int added = 1;
+    while (added) {
+        added = 0;
+        for (int node = 0; node < num_nodes; node++) {
+            while (cursor[node] < MAX_CPUS && node_of_cpu[cursor[node]] != node) {
+                cursor[node]++;
+            }
+            if (cursor[node] < MAX_CPUS) {
+                cpu_order[cpu_count] = cursor[node]++;
+                cpu_node[cpu_count++] = node;
+                added = 1;
+            }
+        }
+    }
+}
+
+// Function to pin the calling worker to its core and prefer memory from that core's node
+void pin_current_worker(int worker_index) {
+    if (!pin_workers || cpu_count == 0) {
+        return;
+    }
+
+    int slot = worker_index % cpu_count;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu_order[slot], &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+        perror("sched_setaffinity failed");
+        return;
+    }
+
+    // Pages this worker touches first (input blocks, result records) now come from its own node
+    unsigned long node_mask = 1UL << cpu_node[slot];
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8);
+}
+
+// Function to parse a size such as 512K, 64M or 2G into bytes
+long long parse_size(const char *text) {
+    char *end;
+    long long size = strtoll(text, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+    } else if (*end == 'g' || *end == 'G') {
+        size <<= 30;
+    }
+    return size;
+}
+
+// Function to strip the leading options from the argument list
+void parse_options(int *argc, char *argv[]) {
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--pin") == 0) {
+            pin_workers = 1;
+        } else if (strncmp(argv[1], "--mem-budget=", 13) == 0) {
+            mem_budget = parse_size(argv[1] + 13);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++) {
+            argv[i] = argv[i + 1];
+        }
+        (*argc)--;
+    }
+}
+
+// Function to write a whole buffer to a file descriptor, retrying partial writes
+void write_all(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buffer, size);
+        if (written <= 0) {
+            printf("Error: write failed\n");
+            exit(1);
+        }
+        buffer += written;
+        size -= written;
+    }
+}
+
+void process_input_file(char *input_file, char *positive_word, char *negative_word, int pipe_fd, size_t buffer_limit) {
     FILE *file = fopen(input_file, "r");
     if (file == NULL) {
         printf("Error: File not found\n");
@@ -56,12 +195,18 @@ void process_input_file(char *input_file, char *positive_word, char *negative_wo
             }
             snprintf(buffer + buffer_size, needed_size, "%s, %d: %sSentiment Score: %d\n", input_file, line_number, original_line, sentiment_score);
             buffer_size += needed_size - 1;
+
+            // Hand the buffered lines to the parent once the buffer reaches its share of the budget
+            if (buffer_limit && buffer_size >= buffer_limit) {
+                write_all(pipe_fd, buffer, buffer_size);
+                buffer_size = 0;
+            }
         }
         free(original_line);
         sentiment_score = 0; // Reset sentiment score for the next line
     }
     free(line);
-    write(pipe_fd, buffer, buffer_size);
+    write_all(pipe_fd, buffer, buffer_size);
     free(buffer);
     fclose(file);
     close(pipe_fd); // Close the write end of the pipe
@@ -74,31 +219,17 @@ void collect_results(int num_files, char *final_output_file, int pipes[][2]) {
         exit(1);
     }
 
+    // Stream each pipe straight into the output with a fixed buffer, children are drained in order
+    char buffer[64 * 1024];
     for (int i = 0; i < num_files; i++) {
-        close(pipes[i][1]); // Close the write end of the pipe in the parent process
-        char *buffer = NULL;
-        size_t buffer_size = 0;
         ssize_t bytes_read;
-        while (1) {
-            buffer = realloc(buffer, buffer_size + 1024);
-            if (buffer == NULL) {
-                printf("Error: realloc failed\n");
+        while ((bytes_read = read(pipes[i][0], buffer, sizeof(buffer))) > 0) {
+            if (fwrite(buffer, 1, bytes_read, final_output) != (size_t)bytes_read) {
+                printf("Error: fwrite failed\n");
                 fclose(final_output);
                 exit(1);
             }
-            bytes_read = read(pipes[i][0], buffer + buffer_size, 1024);
-            if (bytes_read <= 0) {
-                break;
-            }
-            buffer_size += bytes_read;
-        }
-        if (fwrite(buffer, 1, buffer_size, final_output) != buffer_size) {
-            printf("Error: fwrite failed\n");
-            free(buffer);
-            fclose(final_output);
-            exit(1);
         }
-        free(buffer);
         close(pipes[i][0]); // Close the read end of the pipe
     }
 
@@ -106,8 +237,9 @@ void collect_results(int num_files, char *final_output_file, int pipes[][2]) {
 }
 
 int main(int argc, char *argv[]) {
+    parse_options(&argc, argv);
     if (argc < 6) {
-        printf("Usage: %s <positive_word> <negative_word> <num_files> <input_file1> [<input_file2> ...] <output_file>\n", argv[0]);
+        printf("Usage: %s [--pin] [--mem-budget=<size>] <positive_word> <negative_word> <num_files> <input_file1> [<input_file2> ...] <output_file>\n", argv[0]);
         return 1;
     }
 
@@ -118,6 +250,11 @@ int main(int argc, char *argv[]) {
     int num_files = atoi(argv[3]);
     char *final_output_file = argv[argc - 1];
 
+    // Work out the core each child will be pinned to
+    if (pin_workers) {
+        build_cpu_order();
+    }
+
     int pipes[MAX_FILES][2];
 
     for (int i = 0; i < num_files; i++) {
@@ -131,18 +268,26 @@ int main(int argc, char *argv[]) {
             printf("Error: Fork failed\n");
             exit(1);
         } else if (pid == 0) {
+            pin_current_worker(i);
             close(pipes[i][0]); // Close the read end of the pipe in the child process
-            process_input_file(argv[4 + i], positive_word, negative_word, pipes[i][1]);
+
+            // Close the inherited pipes of earlier children so their readers see end of file
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+            }
+            process_input_file(argv[4 + i], positive_word, negative_word, pipes[i][1], mem_budget / num_files);
             exit(0);
         }
+        close(pipes[i][1]); // Close the write end of the pipe in the parent process
     }
 
+    // Collect while the children run, so no child blocks forever on a full pipe
+    collect_results(num_files, final_output_file, pipes);
+
     for (int i = 0; i < num_files; i++) {
         wait(NULL); // Wait for all child processes to finish
     }
 
-    collect_results(num_files, final_output_file, pipes);
-
     clock_t end_time = clock();
     double execution_time = ((double) (end_time - start_time)) / CLOCKS_PER_SEC;
     printf("Execution time: %.10f seconds\n", execution_time);
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +6,10 @@
 #include <semaphore.h>
 #include <time.h>
 #include <ctype.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define MAX_LINE_LENGTH 1024
 #define MAX_FILENAME_LENGTH 256
@@ -18,9 +23,15 @@ typedef struct LineInfo
     struct LineInfo *next;
 } LineInfo;
 
-// Global linked list to hold the results
-LineInfo *head = NULL;
-sem_t list_semaphore;
+// Structure to hold the results of one input file, owned by the thread processing it
+typedef struct
+{
+    LineInfo *head;
+    LineInfo *tail;
+    size_t memory_used;
+    size_t memory_limit; // Share of --mem-budget for this slot, 0 for unlimited
+    FILE *run_file;      // Lines already spilled to disk, in file order
+} ResultSlot;
 
 // Structure for thread arguments
 typedef struct
@@ -28,6 +39,8 @@ typedef struct
     const char *filename;
     const char *possitive_word;
     const char *negative_word;
+    int worker_index;
+    ResultSlot *slot;
 } ThreadArgs;
 // Function to check if a character is a word boundary by checking if the character is an alphabet or not
 int is_word_boundary(char c)
@@ -60,8 +73,384 @@ int count_word_in_line(const char *line, const char *word)
     return count;
 }
 
-// Function to add a line to the linked list
-void add_to_list(const char *filename, int line_number, const char *line)
+// Worker placement: with --pin every worker is pinned to one core, spreading workers across NUMA nodes
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+int pin_workers = 0;
+long long mem_budget = 0; // Bytes of results kept in memory before spilling to disk, 0 for unlimited
+int cpu_order[MAX_CPUS];
+int cpu_node[MAX_CPUS];
+int cpu_count = 0;
+
+// Function to build the CPU order so that consecutive workers alternate between NUMA nodes
+void build_cpu_order(void)
+{
+    int node_of_cpu[MAX_CPUS];
+    int num_nodes = 0;
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        node_of_cpu[cpu] = CPU_ISSET(cpu, &allowed) ? 0 : -1;
+    }
+
+    // Read the CPU list of every NUMA node from sysfs, e.g. "0-3,8-11"
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (!file)
+        {
+            break;
+        }
+        int first, last;
+        char separator;
+        while (fscanf(file, "%d", &first) == 1)
+        {
+            last = first;
+            if (fscanf(file, "%c", &separator) == 1 && separator == '-')
+            {
+                fscanf(file, "%d%c", &last, &separator);
+            }
+            for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++)
+            {
+                if (node_of_cpu[cpu] >= 0)
+                {
+                    node_of_cpu[cpu] = node;
+                }
+            }
+        }
+        fclose(file);
+        num_nodes++;
+    }
+    if (num_nodes == 0)
+    {
+        num_nodes = 1;
+    }
+
+    // Interleave the nodes: first CPU of node 0, first CPU of node 1, second CPU of node 0, ...
+    int cursor[MAX_NODES] = {0};
+    int added = 1;
+    while (added)
+    {
+        added = 0;
+        for (int node = 0; node < num_nodes; node++)
+        {
+            while (cursor[node] < MAX_CPUS && node_of_cpu[cursor[node]] != node)
+            {
+                cursor[node]++;
+            }
+            if (cursor[node] < MAX_CPUS)
+            {
+                cpu_order[cpu_count] = cursor[node]++;
+                cpu_node[cpu_count++] = node;
+                added = 1;
+            }
+        }
+    }
+}
+
+// Function to pin the calling worker to its core and prefer memory from that core's node
+void pin_current_worker(int worker_index)
+{
+    if (!pin_workers || cpu_count == 0)
+    {
+        return;
+    }
+
+    int slot = worker_index % cpu_count;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu_order[slot], &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
+    {
+        perror("sched_setaffinity failed");
+        return;
+    }
+
+    // Pages this worker touches first (input blocks, result records) now come from its own node
+    unsigned long node_mask = 1UL << cpu_node[slot];
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8);
+}
+
+// Function to parse a size such as 512K, 64M or 2G into bytes
+long long parse_size(const char *text)
+{
+    char *end;
+    long long size = strtoll(text, &end, 10);
+    if (*end == 'k' || *end == 'K')
+    {
+        size <<= 10;
+    }
+    else if (*end == 'm' || *end == 'M')
+    {
+        size <<= 20;
+    }
+    else if (*end == 'g' || *end == 'G')
+    {
+        size <<= 30;
+    }
+    return size;
+}
+
+// Function to strip the leading options from the argument list
+void parse_options(int *argc, char *argv[])
+{
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strcmp(argv[1], "--pin") == 0)
+        {
+            pin_workers = 1;
+        }
+        else if (strncmp(argv[1], "--mem-budget=", 13) == 0)
+        {
+            mem_budget = parse_size(argv[1] + 13);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++)
+        {
+            argv[i] = argv[i + 1];
+        }
+        (*argc)--;
+    }
+}
+
+// Readahead pipeline: a dedicated I/O thread fills blocks while the worker scores the previous one
+#define READAHEAD_BLOCK_SIZE (1024 * 1024)
+#define READAHEAD_BUFFERS 3
+
+// Struct to hold a block of the input file
+typedef struct
+{
+    char *data;
+    ssize_t length; // 0 at end of file, -1 on read error
+} ReadBlock;
+
+// Struct to hold the readahead state of a single worker
+typedef struct
+{
+    int fd;
+    ReadBlock blocks[READAHEAD_BUFFERS];
+    sem_t filled; // Blocks ready to be consumed by the worker
+    sem_t empty;  // Blocks ready to be refilled by the I/O thread
+    pthread_t io_thread;
+    volatile int stop;
+    ReadBlock *current;
+    int next_block;
+    size_t offset;
+    int eof;
+} ReadAhead;
+
+// Function run by the I/O thread: read the file block by block into the free buffers
+void *readahead_io_thread(void *arg)
+{
+    ReadAhead *ra = (ReadAhead *)arg;
+    off_t file_offset = 0;
+
+    for (int i = 0;; i = (i + 1) % READAHEAD_BUFFERS)
+    {
+        // Wait for the worker to hand back a buffer
+        sem_wait(&ra->empty);
+        if (ra->stop)
+        {
+            break;
+        }
+
+        // Fill the whole block so the worker sees as few hand-offs as possible
+        ReadBlock *block = &ra->blocks[i];
+        block->length = 0;
+        while (block->length < READAHEAD_BLOCK_SIZE)
+        {
+            ssize_t bytes_read = read(ra->fd, block->data + block->length, READAHEAD_BLOCK_SIZE - block->length);
+            if (bytes_read < 0)
+            {
+                block->length = -1;
+                break;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            block->length += bytes_read;
+        }
+        file_offset += block->length > 0 ? block->length : 0;
+
+        // Ask the kernel to start fetching the block after the next one
+        posix_fadvise(ra->fd, file_offset, READAHEAD_BLOCK_SIZE, POSIX_FADV_WILLNEED);
+
+        int done = block->length < READAHEAD_BLOCK_SIZE;
+        sem_post(&ra->filled);
+        if (done)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Function to open a file and start its readahead I/O thread
+int readahead_open(ReadAhead *ra, const char *filename)
+{
+    memset(ra, 0, sizeof(ReadAhead));
+    ra->fd = open(filename, O_RDONLY);
+    if (ra->fd < 0)
+    {
+        return -1;
+    }
+    posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (int i = 0; i < READAHEAD_BUFFERS; i++)
+    {
+        ra->blocks[i].data = malloc(READAHEAD_BLOCK_SIZE);
+        if (!ra->blocks[i].data)
+        {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // All buffers start empty, none are filled yet
+    sem_init(&ra->filled, 0, 0);
+    sem_init(&ra->empty, 0, READAHEAD_BUFFERS);
+    if (pthread_create(&ra->io_thread, NULL, readahead_io_thread, ra) != 0)
+    {
+        perror("Thread creation failed");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+// Function to read the next line from the readahead buffers with the same semantics as fgets
+char *readahead_gets(ReadAhead *ra, char *line, size_t size)
+{
+    size_t copied = 0;
+
+    while (copied < size - 1)
+    {
+        // Move to the next block once the current one is consumed
+        if (!ra->current || ra->offset == (size_t)ra->current->length)
+        {
+            if (ra->eof)
+            {
+                break;
+            }
+            if (ra->current)
+            {
+                sem_post(&ra->empty);
+            }
+            sem_wait(&ra->filled);
+            ra->current = &ra->blocks[ra->next_block];
+            ra->next_block = (ra->next_block + 1) % READAHEAD_BUFFERS;
+            ra->offset = 0;
+            if (ra->current->length < 0)
+            {
+                perror("Error reading file");
+            }
+            if (ra->current->length < READAHEAD_BLOCK_SIZE)
+            {
+                ra->eof = 1;
+            }
+            if (ra->current->length <= 0)
+            {
+                ra->current->length = 0;
+                break;
+            }
+        }
+
+        // Copy up to the end of the line, the end of the block or the end of the caller's buffer
+        const char *start = ra->current->data + ra->offset;
+        size_t available = ra->current->length - ra->offset;
+        if (available > size - 1 - copied)
+        {
+            available = size - 1 - copied;
+        }
+        const char *newline = memchr(start, '\n', available);
+        size_t length = newline ? (size_t)(newline - start) + 1 : available;
+        memcpy(line + copied, start, length);
+        copied += length;
+        ra->offset += length;
+        if (newline)
+        {
+            break;
+        }
+    }
+
+    if (copied == 0)
+    {
+        return NULL;
+    }
+    line[copied] = '\0';
+    return line;
+}
+
+// Function to stop the I/O thread and release the readahead buffers
+void readahead_close(ReadAhead *ra)
+{
+    // Wake the I/O thread in case it is waiting for a free buffer
+    ra->stop = 1;
+    sem_post(&ra->empty);
+    pthread_join(ra->io_thread, NULL);
+
+    sem_destroy(&ra->filled);
+    sem_destroy(&ra->empty);
+    for (int i = 0; i < READAHEAD_BUFFERS; i++)
+    {
+        free(ra->blocks[i].data);
+    }
+    close(ra->fd);
+}
+
+// Function to write a list of lines to a file in the output format
+void write_lines(FILE *file, const LineInfo *current)
+{
+    while (current)
+    {
+        fprintf(file, "%s, %d: %s",
+                current->filename,
+                current->line_number,
+                current->line);
+        current = current->next;
+    }
+}
+
+// Function to spill the in-memory lines of a slot to its run file and free them
+void spill_slot(ResultSlot *slot)
+{
+    if (!slot->run_file)
+    {
+        slot->run_file = tmpfile();
+        if (!slot->run_file)
+        {
+            perror("Error creating run file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The slot only ever grows at the tail, so consecutive spills form one ordered run
+    write_lines(slot->run_file, slot->head);
+    while (slot->head)
+    {
+        LineInfo *temp = slot->head;
+        slot->head = slot->head->next;
+        free(temp);
+    }
+    slot->tail = NULL;
+    slot->memory_used = 0;
+}
+
+// Function to add a line to the end of the result slot's linked list
+void add_to_list(ResultSlot *slot, const char *filename, int line_number, const char *line)
 {
     // Create a new node
     LineInfo *new_node = (LineInfo *)malloc(sizeof(LineInfo));
@@ -78,12 +467,23 @@ void add_to_list(const char *filename, int line_number, const char *line)
     strncpy(new_node->line, line, sizeof(new_node->line) - 1);
     new_node->next = NULL;
 
-    // Critical section: Protect access to the linked list
-    sem_wait(&list_semaphore);
-    // Add the new node to the beginning of the linked list
-    new_node->next = head;
-    head = new_node;
-    sem_post(&list_semaphore);
+    // Only this thread writes to its slot, so no locking is needed and lines stay in file order
+    if (slot->tail)
+    {
+        slot->tail->next = new_node;
+    }
+    else
+    {
+        slot->head = new_node;
+    }
+    slot->tail = new_node;
+
+    // Keep the slot within its share of the memory budget
+    slot->memory_used += sizeof(LineInfo);
+    if (slot->memory_limit && slot->memory_used >= slot->memory_limit)
+    {
+        spill_slot(slot);
+    }
 }
 
 // Function for each thread to execute
@@ -95,9 +495,12 @@ void *process_file(void *args)
     const char *possitive_word = thread_args->possitive_word;
     const char *negative_word = thread_args->negative_word;
 
+    // Pin before allocating anything so the readahead buffers and result nodes are node-local
+    pin_current_worker(thread_args->worker_index);
+
     // Open the file to read
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    ReadAhead file;
+    if (readahead_open(&file, filename) != 0)
     {
         perror("Error opening file");
         // Exit the thread
@@ -109,7 +512,7 @@ void *process_file(void *args)
     int total_sentiment = 0;
 
     // Read the file line by line
-    while (fgets(line, sizeof(line), file))
+    while (readahead_gets(&file, line, sizeof(line)))
     {
         line_number++;
         // Calculate sentiment score for the line
@@ -119,76 +522,23 @@ void *process_file(void *args)
         if (sentiment_score != 0)
         {
             // Add the line to the linked list
-            add_to_list(filename, line_number, line);
+            add_to_list(thread_args->slot, filename, line_number, line);
             total_sentiment += sentiment_score;
         }
     }
 
     printf("Total sentiment score for %s: %d\n", filename, total_sentiment);
 
-    fclose(file);
+    readahead_close(&file);
     pthread_exit(NULL);
 }
 
-// Compare function for sorting linked list
-int compare_lines(const void *a, const void *b)
-{
-    LineInfo *line1 = *(LineInfo **)a;
-    LineInfo *line2 = *(LineInfo **)b;
-
-    // Compare by filename
-    int filename_cmp = strcmp(line1->filename, line2->filename);
-    if (filename_cmp != 0)
-    {
-        return filename_cmp;
-    }
-
-    // If filenames are equal, compare by line number
-    return line1->line_number - line2->line_number;
-}
-
-// Function to sort the linked list
-void sort_linked_list(LineInfo **head_ref)
-{
-    // Count the number of nodes
-    int count = 0;
-    LineInfo *temp = *head_ref;
-    while (temp)
-    {
-        count++;
-        temp = temp->next;
-    }
-
-    // Create an array to hold pointers to each node
-    LineInfo **array = (LineInfo **)malloc(count * sizeof(LineInfo *));
-    // Fill the array with pointers to each node
-    temp = *head_ref;
-    for (int i = 0; i < count; i++)
-    {
-        array[i] = temp;
-        temp = temp->next;
-    }
-
-    // Sort the array with qsort via compare_lines function
-    qsort(array, count, sizeof(LineInfo *), compare_lines);
-
-    // Reconstruct the linked list from the sorted array
-    for (int i = 0; i < count - 1; i++)
-    {
-        array[i]->next = array[i + 1];
-    }
-    array[count - 1]->next = NULL;
-    *head_ref = array[0];
-
-    // Free the array
-    free(array);
-}
-
 int main(int argc, char *argv[])
 {
+    parse_options(&argc, argv);
     if (argc < 5)
     {
-        fprintf(stderr, "Usage: %s <positive_word> <negative_word> <num_files> <input_files...> <output_file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--pin] [--mem-budget=<size>] <positive_word> <negative_word> <num_files> <input_files...> <output_file>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -205,13 +555,16 @@ int main(int argc, char *argv[])
     int num_files = atoi(argv[3]);
     char *output_file = argv[4 + num_files];
 
-    // Initialize the semaphore with a value of 1 meaning it is unlocked 
-    sem_init(&list_semaphore, 0, 1);
-
+    // Work out the core each thread will be pinned to
+    if (pin_workers)
+    {
+        build_cpu_order();
+    }
 
-    // Create threads
+    // Create threads, each with its own result slot indexed by argv position
     pthread_t threads[num_files];
     ThreadArgs thread_args[num_files];
+    ResultSlot slots[num_files];
 
     for (int i = 0; i < num_files; i++)
     {
@@ -219,6 +572,13 @@ int main(int argc, char *argv[])
         thread_args[i].filename = argv[4 + i];
         thread_args[i].possitive_word = possitive_word;
         thread_args[i].negative_word = negative_word;
+        thread_args[i].worker_index = i;
+        thread_args[i].slot = &slots[i];
+        slots[i].head = NULL;
+        slots[i].tail = NULL;
+        slots[i].memory_used = 0;
+        slots[i].memory_limit = mem_budget / num_files;
+        slots[i].run_file = NULL;
         // Create the thread
         if (pthread_create(&threads[i], NULL, process_file, &thread_args[i]) != 0)
         {
@@ -234,10 +594,7 @@ int main(int argc, char *argv[])
         pthread_join(threads[i], NULL);
     }
 
-    // Sort the linked list
-    sort_linked_list(&head);
-
-    // Write sorted results to output file
+    // Write results to output file
     FILE *out_file = fopen(output_file, "w");
     if (!out_file)
     {
@@ -245,26 +602,35 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    // Write the sorted results to the output file
-    LineInfo *current = head;
-    while (current)
+    // Walk the slots in argv order, the output is deterministic without sorting.
+    // Each slot's spilled run precedes its in-memory lines, so the merge is a streaming copy
+    char buffer[64 * 1024];
+    for (int i = 0; i < num_files; i++)
     {
-        fprintf(out_file, "%s, %d: %s",
-                current->filename,
-                current->line_number,
-                current->line);
-        current = current->next;
+        if (slots[i].run_file)
+        {
+            rewind(slots[i].run_file);
+            size_t bytes_read;
+            while ((bytes_read = fread(buffer, 1, sizeof(buffer), slots[i].run_file)) > 0)
+            {
+                fwrite(buffer, 1, bytes_read, out_file);
+            }
+            fclose(slots[i].run_file);
+        }
+        write_lines(out_file, slots[i].head);
     }
 
     fclose(out_file);
 
     // Cleanup
-    sem_destroy(&list_semaphore);
-    while (head)
+    for (int i = 0; i < num_files; i++)
     {
-        LineInfo *temp = head;
-        head = head->next;
-        free(temp);
+        while (slots[i].head)
+        {
+            LineInfo *temp = slots[i].head;
+            slots[i].head = slots[i].head->next;
+            free(temp);
+        }
     }
 
     // Measure the end time
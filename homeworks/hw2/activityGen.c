@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Distribution of the think time before each operation of a thread
+typedef enum
+{
+    ARRIVAL_FIXED,   // Every gap is --think seconds
+    ARRIVAL_POISSON, // Exponential gaps with mean --think, so operations arrive as a Poisson process
+    ARRIVAL_BURST    // --burst operations back to back, then a gap that keeps the mean at --think
+} ArrivalProcess;
+
+// Distribution of operation durations
+typedef enum
+{
+    DURATION_FIXED,      // Every operation takes --mean-duration seconds
+    DURATION_UNIFORM,    // Uniform between 0 and twice --mean-duration
+    DURATION_EXPONENTIAL // Exponential with mean --mean-duration
+} DurationDistribution;
+
+// Generator parameters, set from the command line
+int num_threads = 4;
+int num_tables = 2;
+long num_operations = 10000;
+double read_ratio = 0.8;
+double table_skew = 0.0;
+int num_keys = 0; // 0 generates read/write, otherwise get/put on this many keys
+double key_skew = 0.0;
+ArrivalProcess arrival = ARRIVAL_FIXED;
+double mean_think = 0.0;
+int burst_length = 10;
+DurationDistribution duration_distribution = DURATION_FIXED;
+double mean_duration = 0.0;
+unsigned long long rng_state = 42;
+double unit_scale = 1.0;      // Units of the output time per second
+const char *unit_suffix = ""; // Written after every time; whole seconds need none
+
+// Function to draw the next 64 random bits (xorshift64*)
+unsigned long long next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+// Function to draw a uniform double in [0, 1)
+double next_uniform(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Function to draw an exponential value with the given mean
+double next_exponential(double mean)
+{
+    return -mean * log(1.0 - next_uniform());
+}
+
+// Function to build the cumulative distribution of a Zipfian over n items; skew 0 is uniform
+double *zipf_build(int n, double skew)
+{
+    double *cdf = malloc(n * sizeof(double));
+    if (!cdf)
+    {
+        perror("Error allocating distribution");
+        exit(EXIT_FAILURE);
+    }
+    double total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        total += 1.0 / pow(i + 1, skew);
+        cdf[i] = total;
+    }
+    for (int i = 0; i < n; i++)
+        cdf[i] /= total;
+    return cdf;
+}
+
+// Function to draw an item from a cumulative distribution; item 0 is the most popular
+int zipf_next(const double *cdf, int n)
+{
+    double u = next_uniform();
+    int low = 0, high = n - 1;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (cdf[middle] < u)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// Function to round a time in seconds to whole units of --time-unit
+long round_seconds(double seconds)
+{
+    return (long)(seconds * unit_scale + 0.5);
+}
+
+// Function to draw the think time before the k-th operation of a thread
+long next_think(long k)
+{
+    switch (arrival)
+    {
+    case ARRIVAL_POISSON:
+        return round_seconds(next_exponential(mean_think));
+    case ARRIVAL_BURST:
+        return k % burst_length == 0 ? round_seconds(mean_think * burst_length) : 0;
+    default:
+        return round_seconds(mean_think);
+    }
+}
+
+// Function to draw the duration of an operation
+long next_duration(void)
+{
+    switch (duration_distribution)
+    {
+    case DURATION_UNIFORM:
+        return round_seconds(next_uniform() * 2 * mean_duration);
+    case DURATION_EXPONENTIAL:
+        return round_seconds(next_exponential(mean_duration));
+    default:
+        return round_seconds(mean_duration);
+    }
+}
+
+// Function to parse the options in front of the output file
+void parse_options(int *argc, char *argv[])
+{
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strncmp(argv[1], "--threads=", 10) == 0)
+            num_threads = atoi(argv[1] + 10);
+        else if (strncmp(argv[1], "--tables=", 9) == 0)
+            num_tables = atoi(argv[1] + 9);
+        else if (strncmp(argv[1], "--ops=", 6) == 0)
+            num_operations = atol(argv[1] + 6);
+        else if (strncmp(argv[1], "--read-ratio=", 13) == 0)
+            read_ratio = atof(argv[1] + 13);
+        else if (strncmp(argv[1], "--table-skew=", 13) == 0)
+            table_skew = atof(argv[1] + 13);
+        else if (strncmp(argv[1], "--keys=", 7) == 0)
+            num_keys = atoi(argv[1] + 7);
+        else if (strncmp(argv[1], "--key-skew=", 11) == 0)
+            key_skew = atof(argv[1] + 11);
+        else if (strcmp(argv[1], "--arrival=fixed") == 0)
+            arrival = ARRIVAL_FIXED;
+        else if (strcmp(argv[1], "--arrival=poisson") == 0)
+            arrival = ARRIVAL_POISSON;
+        else if (strcmp(argv[1], "--arrival=burst") == 0)
+            arrival = ARRIVAL_BURST;
+        else if (strncmp(argv[1], "--think=", 8) == 0)
+            mean_think = atof(argv[1] + 8);
+        else if (strncmp(argv[1], "--burst=", 8) == 0)
+            burst_length = atoi(argv[1] + 8);
+        else if (strcmp(argv[1], "--duration=fixed") == 0)
+            duration_distribution = DURATION_FIXED;
+        else if (strcmp(argv[1], "--duration=uniform") == 0)
+            duration_distribution = DURATION_UNIFORM;
+        else if (strcmp(argv[1], "--duration=exponential") == 0)
+            duration_distribution = DURATION_EXPONENTIAL;
+        else if (strncmp(argv[1], "--mean-duration=", 16) == 0)
+            mean_duration = atof(argv[1] + 16);
+        else if (strcmp(argv[1], "--time-unit=s") == 0)
+            unit_scale = 1.0, unit_suffix = "";
+        else if (strcmp(argv[1], "--time-unit=ms") == 0)
+            unit_scale = 1e3, unit_suffix = "ms";
+        else if (strcmp(argv[1], "--time-unit=us") == 0)
+            unit_scale = 1e6, unit_suffix = "us";
+        else if (strcmp(argv[1], "--time-unit=ns") == 0)
+            unit_scale = 1e9, unit_suffix = "ns";
+        else if (strncmp(argv[1], "--seed=", 7) == 0) // Kept odd, xorshift never leaves a zero state
+            rng_state = strtoull(argv[1] + 7, NULL, 10) * 2 + 1;
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++)
+            argv[i] = argv[i + 1];
+        (*argc)--;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_options(&argc, argv);
+    if (argc != 2 || num_threads < 1 || num_tables < 1 || num_operations < 0 || burst_length < 1)
+    {
+        fprintf(stderr, "Usage: %s [--threads=N] [--tables=N] [--ops=N] [--read-ratio=R] [--table-skew=S] [--keys=N] [--key-skew=S] [--arrival=fixed|poisson|burst] [--think=SECONDS] [--burst=N] [--duration=fixed|uniform|exponential] [--mean-duration=SECONDS] [--time-unit=s|ms|us|ns] [--seed=N] <Output_file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *output = strcmp(argv[1], "-") == 0 ? stdout : fopen(argv[1], "w");
+    if (!output)
+    {
+        perror("Error opening output file");
+        return EXIT_FAILURE;
+    }
+    static char output_buffer[1 << 20];
+    setvbuf(output, output_buffer, _IOFBF, sizeof(output_buffer));
+
+    double *table_cdf = zipf_build(num_tables, table_skew);
+    double *key_cdf = num_keys > 0 ? zipf_build(num_keys, key_skew) : NULL;
+
+    // Deal the operations round-robin, so every thread gets the same share and they interleave in the file
+    for (long i = 0; i < num_operations; i++)
+    {
+        int thread_id = i % num_threads + 1;
+        long think = next_think(i / num_threads);
+        int table_id = zipf_next(table_cdf, num_tables) + 1;
+        long duration = next_duration();
+        int reader = next_uniform() < read_ratio;
+        const char *u = unit_suffix;
+
+        if (num_keys == 0)
+        {
+            if (reader)
+                fprintf(output, "%ld%s %d %d read %ld%s\n", think, u, thread_id, table_id, duration, u);
+            else
+                fprintf(output, "%ld%s %d %d write %ld%s v%ld\n", think, u, thread_id, table_id, duration, u, i);
+        }
+        else
+        {
+            int key = zipf_next(key_cdf, num_keys);
+            if (reader)
+                fprintf(output, "%ld%s %d %d get %ld%s %d\n", think, u, thread_id, table_id, duration, u, key);
+            else
+                fprintf(output, "%ld%s %d %d put %ld%s %d v%ld\n", think, u, thread_id, table_id, duration, u, key, i);
+        }
+    }
+
+    if (output != stdout)
+        fclose(output);
+    else
+        fflush(stdout);
+    free(table_cdf);
+    free(key_cdf);
+    return EXIT_SUCCESS;
+}
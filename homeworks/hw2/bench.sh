@@ -0,0 +1,35 @@
+#!/bin/sh
+# Throughput and latency of every lock policy on one generated workload.
+# The operations are dealt evenly to the threads; extra arguments go to activityGen,
+# DBSIM_FLAGS to databaseSim (for example DBSIM_FLAGS=--virtual).
+# Usage: ./bench.sh [threads] [tables] [operations] [activityGen options...]
+
+THREADS=${1:-8}
+TABLES=${2:-4}
+OPERATIONS=${3:-1000000}
+[ $# -gt 3 ] && shift 3 || shift $#
+BINARY=./databaseSim
+GENERATOR=./activityGen
+WORKLOAD=bench_workload.txt
+PROFILE=bench_profile.json
+
+# Build with the Makefile's flags; up-to-date binaries are left alone
+make -s databaseSim activityGen || exit 1
+
+"$GENERATOR" --threads="$THREADS" --tables="$TABLES" --ops="$OPERATIONS" "$@" "$WORKLOAD" || exit 1
+
+printf "%-8s %10s %10s %12s %12s %12s %12s\n" policy ops seconds "ops/s" "p50 (us)" "p99 (us)" "p999 (us)"
+for POLICY in writer fifo phase; do
+    START=$(date +%s.%N)
+    "$BINARY" --fresh $DBSIM_FLAGS --lock-policy=$POLICY --profile="$PROFILE" "$THREADS" "$TABLES" "$WORKLOAD" > /dev/null || exit 1
+    END=$(date +%s.%N)
+
+    # The latency line of the profile: "latency": {"count": N, "mean": M, "p50": A, "p90": B, "p99": C, "p999": D, "max": E}
+    grep '"latency"' "$PROFILE" | sed 's/[{},:"]/ /g' | awk -v policy="$POLICY" -v seconds="$(echo "$END $START" | awk '{ print $1 - $2 }')" '{
+        for (i = 1; i < NF; i++)
+            value[$i] = $(i + 1);
+        printf "%-8s %10d %10.2f %12.0f %12.1f %12.1f %12.1f\n", policy, value["count"], seconds,
+            value["count"] / seconds, value["p50"] / 1000, value["p99"] / 1000, value["p999"] / 1000;
+    }'
+done
+rm -f "$WORKLOAD" "$PROFILE"
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Load generator parameters, set from the command line
+const char *address = "unix:databaseSim.sock";
+int num_connections = 4;
+long requests_per_connection = 10000;
+int pipeline_depth = 1; // Requests a connection keeps in flight
+int num_tables = 2;
+double read_ratio = 0.8;
+int num_keys = 0; // 0 sends read/write, otherwise get/put on this many keys
+unsigned long long seed = 42;
+
+// State of one connection; latencies are kept per request and merged at the end
+typedef struct
+{
+    int index;
+    pthread_t thread;
+    unsigned long long rng_state;
+    long long *latencies; // Nanoseconds from sending a request to reading its reply
+    long errors;
+} ClientConnection;
+
+// Function to read the monotonic clock in nanoseconds
+long long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Function to draw the next 64 random bits of a connection (xorshift64*)
+unsigned long long next_random(ClientConnection *connection)
+{
+    connection->rng_state ^= connection->rng_state >> 12;
+    connection->rng_state ^= connection->rng_state << 25;
+    connection->rng_state ^= connection->rng_state >> 27;
+    return connection->rng_state * 2685821657736338717ULL;
+}
+
+// Function to connect to the server: "unix:PATH" or "tcp:PORT" on the loopback interface
+int connect_to_server(void)
+{
+    int fd;
+    if (strncmp(address, "unix:", 5) == 0)
+    {
+        struct sockaddr_un unix_address = {.sun_family = AF_UNIX};
+        strncpy(unix_address.sun_path, address + 5, sizeof(unix_address.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) != 0)
+        {
+            perror("Error connecting");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strncmp(address, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in tcp_address = {.sin_family = AF_INET, .sin_port = htons(atoi(address + 4))};
+        tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&tcp_address, sizeof(tcp_address)) != 0)
+        {
+            perror("Error connecting");
+            exit(EXIT_FAILURE);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    else
+    {
+        fprintf(stderr, "Unknown server address: %s\n", address);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+// Function to format the k-th request of a connection
+int format_request(ClientConnection *connection, long k, char *buffer, size_t size)
+{
+    int table_id = next_random(connection) % num_tables + 1;
+    int reader = (next_random(connection) >> 11) * (1.0 / 9007199254740992.0) < read_ratio;
+    if (num_keys == 0)
+    {
+        if (reader)
+            return snprintf(buffer, size, "read %d\n", table_id);
+        return snprintf(buffer, size, "write %d c%dr%ld\n", table_id, connection->index, k);
+    }
+    int key = next_random(connection) % num_keys;
+    if (reader)
+        return snprintf(buffer, size, "get %d %d\n", table_id, key);
+    return snprintf(buffer, size, "put %d %d c%dr%ld\n", table_id, key, connection->index, k);
+}
+
+// Function to write a whole buffer to the socket
+void send_all(int fd, const char *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            perror("Error sending");
+            exit(EXIT_FAILURE);
+        }
+        buffer += sent;
+        size -= sent;
+    }
+}
+
+// Connection thread: keeps up to pipeline_depth requests in flight and times each one from send to reply
+void *connection_function(void *arg)
+{
+    ClientConnection *connection = arg;
+    int fd = connect_to_server();
+    long long *sent_at = malloc(pipeline_depth * sizeof(long long));
+    char *output = malloc(pipeline_depth * 128);
+    char input[65536];
+    size_t input_length = 0;
+    long sent = 0, received = 0;
+
+    while (received < requests_per_connection)
+    {
+        // Top the pipeline up with one send
+        size_t output_length = 0;
+        long first = sent;
+        while (sent < requests_per_connection && sent - received < pipeline_depth)
+        {
+            output_length += format_request(connection, sent, output + output_length, 128);
+            sent++;
+        }
+        if (output_length > 0)
+        {
+            long long now = now_ns();
+            for (long k = first; k < sent; k++)
+                sent_at[k % pipeline_depth] = now;
+            send_all(fd, output, output_length);
+        }
+
+        // Replies come back in request order
+        ssize_t count = read(fd, input + input_length, sizeof(input) - input_length);
+        if (count <= 0)
+        {
+            fprintf(stderr, "Connection %d closed by the server\n", connection->index);
+            exit(EXIT_FAILURE);
+        }
+        input_length += count;
+        long long now = now_ns();
+        char *line = input;
+        char *newline;
+        while ((newline = memchr(line, '\n', input + input_length - line)))
+        {
+            if (strncmp(line, "ERR", 3) == 0)
+                connection->errors++;
+            connection->latencies[received] = now - sent_at[received % pipeline_depth];
+            received++;
+            line = newline + 1;
+        }
+        input_length = input + input_length - line;
+        memmove(input, line, input_length);
+    }
+
+    close(fd);
+    free(sent_at);
+    free(output);
+    return NULL;
+}
+
+// Compare function for sorting latencies
+int compare_latencies(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to parse the options in front of the output
+void parse_options(int *argc, char *argv[])
+{
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strncmp(argv[1], "--connect=", 10) == 0)
+            address = argv[1] + 10;
+        else if (strncmp(argv[1], "--connections=", 14) == 0)
+            num_connections = atoi(argv[1] + 14);
+        else if (strncmp(argv[1], "--requests=", 11) == 0)
+            requests_per_connection = atol(argv[1] + 11);
+        else if (strncmp(argv[1], "--pipeline=", 11) == 0)
+            pipeline_depth = atoi(argv[1] + 11);
+        else if (strncmp(argv[1], "--tables=", 9) == 0)
+            num_tables = atoi(argv[1] + 9);
+        else if (strncmp(argv[1], "--read-ratio=", 13) == 0)
+            read_ratio = atof(argv[1] + 13);
+        else if (strncmp(argv[1], "--keys=", 7) == 0)
+            num_keys = atoi(argv[1] + 7);
+        else if (strncmp(argv[1], "--seed=", 7) == 0)
+            seed = strtoull(argv[1] + 7, NULL, 10);
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++)
+            argv[i] = argv[i + 1];
+        (*argc)--;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_options(&argc, argv);
+    if (argc != 1 || num_connections < 1 || requests_per_connection < 1 || pipeline_depth < 1 || num_tables < 1 ||
+        num_keys < 0)
+    {
+        fprintf(stderr, "Usage: %s [--connect=unix:PATH|tcp:PORT] [--connections=N] [--requests=N] [--pipeline=N] [--tables=N] [--read-ratio=R] [--keys=N] [--seed=N]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ClientConnection *connections = calloc(num_connections, sizeof(ClientConnection));
+    long total = num_connections * requests_per_connection;
+    long long *latencies = malloc(total * sizeof(long long));
+    if (!connections || !latencies)
+    {
+        perror("Error allocating connections");
+        return EXIT_FAILURE;
+    }
+
+    long long start = now_ns();
+    for (int i = 0; i < num_connections; i++)
+    {
+        // Kept odd, xorshift never leaves a zero state
+        connections[i].index = i + 1;
+        connections[i].rng_state = (seed + i) * 2 + 1;
+        connections[i].latencies = latencies + i * requests_per_connection;
+        pthread_create(&connections[i].thread, NULL, connection_function, &connections[i]);
+    }
+    long errors = 0;
+    for (int i = 0; i < num_connections; i++)
+    {
+        pthread_join(connections[i].thread, NULL);
+        errors += connections[i].errors;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    qsort(latencies, total, sizeof(long long), compare_latencies);
+    printf("Requests: %ld in %.2f s, %.0f requests/s, %ld errors\n", total, seconds, total / seconds, errors);
+    printf("Latency (us): p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n", latencies[total / 2] / 1e3,
+           latencies[(long)(total * 0.99)] / 1e3, latencies[(long)(total * 0.999)] / 1e3, latencies[total - 1] / 1e3);
+
+    free(latencies);
+    free(connections);
+    return EXIT_SUCCESS;
+}
@@ -1,238 +1,5311 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <ucontext.h>
+#include <limits.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <errno.h>
+
+#define CACHE_LINE_SIZE 64
+#define MAX_READER_SHARDS 64
+
+// M:N executor: with --workers=N the trace threads run as clients, user-space coroutines
+// multiplexed onto N worker threads. A client that has to wait parks and its worker runs another client
+#define CLIENT_STACK_SIZE (128 * 1024)
+
+// Logical client: one thread id of the trace
+typedef struct Client
+{
+    ucontext_t context;
+    int thread_id;
+    int worker;          // Clients never move between workers, so thread-local state stays valid across a park
+    int finished;
+    long long wake_ns;   // Sleeping clients: CLOCK_MONOTONIC time to wake up
+    struct Client *next; // Next client in a ready queue or in a condition's parked list
+} Client;
+
+// Worker thread and the clients it runs
+typedef struct
+{
+    pthread_mutex_t mutex; // Protects the ready queue, other threads wake clients into it
+    pthread_cond_t wakeup; // Signalled when a client becomes ready
+    Client *ready_head;
+    Client *ready_tail;
+    Client **sleeping;     // Min-heap of sleeping clients by wake time, only touched by the worker itself
+    int sleeping_count;
+    int sleeping_capacity;
+    int live;              // Clients that have not finished
+    ucontext_t scheduler;
+    pthread_t thread;
+} Worker;
+
+int num_workers = 0; // 0 runs every trace thread on its own OS thread
+Worker *workers;
+Client *clients;
+char *client_stacks;
+_Thread_local Client *current_client; // Client running on the calling worker, NULL on other threads
+
+// Mutex implementations of the table locks, the lock managers and group commit
+typedef enum
+{
+    MUTEX_FUTEX, // Spin a while, then sleep on a futex (default)
+    MUTEX_MCS    // MCS queue lock: waiters line up and each spins or sleeps on its own node
+} MutexKind;
+
+// Queue node of a thread waiting for or holding an MCS mutex
+typedef struct McsNode
+{
+    _Atomic(struct McsNode *) next;
+    atomic_int locked; // 1 while waiting, 2 while asleep on the futex, 0 once the mutex was handed over
+} McsNode;
+
+// Mutex of the kind selected with --mutex
+typedef struct
+{
+    atomic_int state;        // Futex: 0 free, 1 locked, 2 locked and a waiter may be asleep
+    atomic_int spins;        // Futex: adaptive spin estimate, like glibc's adaptive mutexes
+    _Atomic(McsNode *) tail; // MCS: last node in the queue, NULL while free
+    McsNode *owner;          // MCS: node of the holder
+} Mutex;
+
+MutexKind mutex_kind = MUTEX_FUTEX;
+int mutex_max_spins = 100; // Set to 0 on a single CPU, where spinning only delays the holder
+
+// A thread holds at most this many MCS mutexes at once, each with its own node
+#define MCS_MAX_DEPTH 4
+_Thread_local McsNode mcs_nodes[MCS_MAX_DEPTH];
+_Thread_local int mcs_depth;
+
+// Condition variable that OS threads and parked clients can both wait on
+typedef struct
+{
+    atomic_int sequence; // Futex word of OS threads, incremented by every broadcast
+    atomic_int waiters;  // OS threads that may be asleep on sequence
+    Client *parked_head; // Clients parked on the condition, woken by condition_broadcast
+    Client *parked_tail;
+} Condition;
+
+// Lock policies for the per-table reader-writer locks
+typedef enum
+{
+    POLICY_WRITER_PREFERENCE, // No new reader may start while a writer is waiting (default)
+    POLICY_FIFO,              // Readers and writers are admitted in arrival order
+    POLICY_PHASE_FAIR         // Read and write phases alternate, nobody waits for more than one phase
+} LockPolicy;
+
+// Reader counter on its own cache line, so readers on different CPUs never share one
+typedef struct
+{
+    atomic_int count;
+    char padding[CACHE_LINE_SIZE - sizeof(atomic_int)];
+} ReaderShard;
+
+// Reader-writer lock of a single table
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) Mutex mutex; // Protects the slow path state below; every lock starts a cache line
+    Condition changed;           // Broadcast whenever a waiter may be able to proceed
+    atomic_int writers_pending;  // Writers waiting or writing, readers take the fast path only at 0
+    int writer_active;           // A writer owns the table (it may still be draining readers)
+    unsigned long next_ticket;   // FIFO: next ticket handed out to a queued reader or writer
+    unsigned long serving;       // FIFO: ticket allowed to enter next
+    unsigned long phase;         // Phase-fair: incremented at the end of every write phase
+    int readers_waiting;         // Phase-fair: readers waiting for the current write phase to end
+    int readers_admitted;        // Phase-fair: readers let in by the last writer that have not entered yet
+    ReaderShard *shards;         // Per-CPU reader counters
+} TableLock;
+
+// Lock initialization
+TableLock *table_locks;
+LockPolicy lock_policy = POLICY_WRITER_PREFERENCE;
+int num_reader_shards = 1;
+
+// Lock granularity: whole tables, or intention locks on tables and locks on keys
+typedef enum
+{
+    GRANULARITY_TABLE, // Every operation locks its whole table (default)
+    GRANULARITY_KEY    // Operations on disjoint keys of a table run concurrently
+} LockGranularity;
+
+LockGranularity lock_granularity = GRANULARITY_TABLE;
+
+// Lock modes of the hierarchical lock manager
+typedef enum
+{
+    LOCK_NONE,
+    LOCK_IS, // Intention to read keys of the table
+    LOCK_IX, // Intention to change keys of the table
+    LOCK_S,  // Shared
+    LOCK_X   // Exclusive
+} LockMode;
+
+// Locks one operation holds on a table and on a range of its keys
+typedef struct LockRequest
+{
+    unsigned long timestamp; // Wait-die age: a smaller timestamp is an older request
+    LockMode table_mode;
+    LockMode key_mode;       // LOCK_NONE for whole-table operations
+    int low;                 // Locked keys, low to high inclusive
+    int high;
+    struct LockRequest *next;
+} LockRequest;
+
+// Lock manager of a single table
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) Mutex mutex;
+    Condition released;       // Broadcast whenever a request lets go of its locks
+    LockRequest *granted;     // Requests holding locks on the table
+    pthread_rwlock_t latch;   // Held only while a key operation reads or changes the index
+} TableLockManager;
+
+TableLockManager *lock_managers;
+atomic_ulong lock_clock; // Hands out wait-die timestamps, 0 is kept for compaction
+
+// Replay in virtual time instead of sleeping
+int virtual_time = 0;
+long long sim_now = 0; // Current virtual time in nanoseconds
+
+// Operation types
+typedef enum
+{
+    OP_READ,   // Read every row of the table
+    OP_WRITE,  // Append a row
+    OP_GET,    // Look up one key
+    OP_PUT,    // Insert or replace a key
+    OP_DELETE, // Remove a key
+    OP_SCAN,   // Read the keys of a range
+    OP_BEGIN,  // Start of a transaction
+    OP_COMMIT, // End of a transaction
+    OP_UNKNOWN
+} OperationType;
+
+// Activity structure
+typedef struct
+{
+    long long operation_time;  // Nanoseconds to wait before the activity
+    int thread_id;
+    int table_id;
+    OperationType operation_type;
+    long long duration;        // Nanoseconds the activity holds its table
+    int key;                   // Key of get, put and delete, first key of scan
+    int key_end;               // Last key of scan
+    const char *written_value; // Points into value_arena
+} Activity;
+
+// Activity initialization
+Activity *activities;
+// Written values of all activities, NUL-separated in a single allocation
+char *value_arena;
+// Number of activities
+int num_activities = 0;
+
+// Per-thread activity queues in CSR form: the activities of thread t are
+// thread_activities[thread_offsets[t - 1]] .. thread_activities[thread_offsets[t] - 1]
+int *thread_offsets;
+int *thread_activities;
+
+// Shared-nothing mode (--shared-nothing=N): every table belongs to one of N owner threads, which apply
+// all of its operations without any lock. Clients send operations through single-producer rings
+#define REQUEST_RING_SIZE 64 // Requests per ring, a power of two
+
+// Operation sent to the owner of its table; it lives on the client's stack until the owner is done
+typedef struct
+{
+    const Activity *activity;
+    int thread_id;
+    unsigned long lsn; // Set by the owner: position of the write's log record, for persist_sync
+    Client *client;    // Client to wake when done, NULL for an OS thread
+    atomic_int done;   // OS threads: futex word the owner sets when done
+} OwnerRequest;
+
+// Ring from one OS thread to one owner, head and tail on separate cache lines
+typedef struct
+{
+    atomic_size_t tail; // Written by the producing thread
+    char tail_padding[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    atomic_size_t head; // Written by the owner
+    char head_padding[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    OwnerRequest *requests[REQUEST_RING_SIZE];
+} RequestRing;
+
+// Owner thread of the tables whose index modulo the number of owners is its own
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) RequestRing *rings; // One ring per producing OS thread, indexed by log_slot
+    atomic_int doorbell; // Futex word, rung by producers when the owner may be asleep
+    atomic_int sleeping;
+    atomic_int pause;    // Set while compaction reads the owner's tables
+    atomic_int paused;   // Set by the owner once it stopped for the compaction
+    atomic_int stop;
+    pthread_t thread;
+} TableOwner;
+
+int num_owners = 0;
+TableOwner *owners;
+int num_request_rings;
+
+// Thread initialization
+pthread_t *threads;
+
+// Table initialization
+char **tables;
+int num_tables;
+
+// Ordered key-value index of a table: an in-memory B+-tree with integer keys
+#define BTREE_ORDER 32 // Nodes split when they reach this many keys
+
+typedef struct BTreeNode
+{
+    int leaf;
+    int count;                                   // Keys in the node, kept sorted
+    int keys[BTREE_ORDER];
+    struct BTreeNode *children[BTREE_ORDER + 1]; // Internal nodes: keys below keys[i] are in children[i]
+    char *values[BTREE_ORDER];                   // Leaves: value of keys[i]
+    unsigned long versions[BTREE_ORDER];         // Leaves: commit timestamp of the last write of keys[i]
+    unsigned long node_version;                  // Leaves: commit timestamp of the last insert, delete or split
+    struct BTreeNode *next;                      // Leaves: right neighbour, for range scans
+} BTreeNode;
+
+// In-memory rows and key-value index of a table, protected by the table's lock
+typedef struct
+{
+    char **rows;
+    int row_count;
+    int row_capacity;
+    BTreeNode *index; // Root of the key-value index, NULL while it is empty
+    int key_count;
+    unsigned long key_set_version; // Commit timestamp of the last insert or delete of a key
+} TableStore;
+
+TableStore *table_stores;
+atomic_long rows_read;
+
+// Buffer pool (--buffer-pool=N): whole-table reads go through N shared pages of the table files instead of
+// the rows in memory. Rows written since the last checkpoint are not in the file yet and are read from memory
+#define POOL_PAGE_SIZE 4096
+
+// Frame of the buffer pool, holding one page of a table file
+typedef struct
+{
+    int table_id;             // Page held by the frame, table_id -1 while the frame is empty
+    unsigned long generation;
+    long page_number;
+    int length;               // Bytes of the page that belong to the file
+    int loading;              // Set while the page is read from disk
+    int pins;                 // Readers using the page; a pinned frame is never evicted
+    int referenced;           // CLOCK reference bit, set on every hit
+    int next;                 // Next frame in the same hash bucket, -1 at the end
+    char data[POOL_PAGE_SIZE];
+} BufferFrame;
+
+// Table file as of the last checkpoint
+typedef struct
+{
+    pthread_rwlock_t lock;    // Reads of the file take the read side, a checkpoint swaps it under the write side
+    int fd;
+    unsigned long generation; // Bumped by every checkpoint, so pages of the old file are never hit again
+    long bytes;
+    int rows;
+} TableFile;
+
+int buffer_pool_pages = 0;
+BufferFrame *buffer_frames;
+int *buffer_buckets; // Hash buckets of frame indices, -1 when empty
+int num_buffer_buckets;
+int clock_hand;
+int pool_waiters; // Readers waiting for a frame to be unpinned
+Mutex pool_mutex;
+Condition pool_changed; // Broadcast when a page finished loading or a frame was unpinned while readers waited
+TableFile *table_files;
+long pool_hits, pool_misses, pool_evictions;
+
+// Multi-version mode: readers take a snapshot of the latest committed version without any lock
+int mvcc = 0;
+
+// Committed version of a table. Versions are never changed once published; a new version
+// shares the rows array of the previous one until the array has to grow
+typedef struct
+{
+    char **rows;
+    int row_count;
+    int row_capacity;
+    unsigned long commit_ts;
+} TableVersion;
+
+_Atomic(TableVersion *) *table_versions;
+atomic_ulong commit_clock; // Global commit timestamp, incremented by every write
+
+// Epoch-based reclamation: memory a writer unlinked is freed once no reader can still hold it
+typedef struct Retired
+{
+    void *pointer;
+    unsigned long epoch; // Global epoch when the pointer was retired
+    struct Retired *next;
+} Retired;
+
+// Per-thread epoch state on its own cache line
+typedef struct
+{
+    atomic_ulong epoch;   // Epoch observed when the thread entered, 0 while outside
+    Retired *retired_head; // Retired pointers of this thread, oldest first
+    Retired *retired_tail;
+    char padding[CACHE_LINE_SIZE - sizeof(atomic_ulong) - 2 * sizeof(Retired *)];
+} EpochSlot;
+
+atomic_ulong global_epoch = 1;
+EpochSlot *epoch_slots;
+int num_epoch_slots;
+_Thread_local int thread_slot; // Slot of the running trace thread or client: its thread id, 0 for the main thread
+_Thread_local int log_slot;    // Log ring of the calling OS thread: its thread id, with --workers its worker number
+
+// Replay timing: every trace thread follows a timeline that starts at an epoch shared by all threads and
+// moves by the trace's times and by waits for tables, so late wake-ups do not add up over a thread's activities
+typedef struct
+{
+    long long planned;  // Absolute CLOCK_MONOTONIC time the thread's schedule has reached
+    long long lateness; // How far the thread ran behind its schedule when it last woke up
+} ReplayTimeline;
+
+long long replay_epoch_ns;
+ReplayTimeline *replay_timelines; // By thread id
+double replay_speed = 1.0;        // --speed=Nx divides every operation time and duration by N
+
+// Result of the operation the calling thread just ran, filled in while it held the table's lock. Server
+// threads answer requests with it
+_Thread_local long reply_count;  // Rows read, row written, keys scanned, or whether a key was found
+_Thread_local char *reply_value; // Value found by get, copied only if collect_reply is set
+_Thread_local int collect_reply;
+
+// Write-ahead log, kept open for the whole run and compacted into the table files
+#define WAL_FILENAME "wal.txt"
+#define WAL_OLD_FILENAME "wal.old.txt"
+int wal_fd = -1;
+pthread_rwlock_t wal_lock = PTHREAD_RWLOCK_INITIALIZER; // Appends take the read side, compaction swaps the file under the write side
+pthread_mutex_t compaction_mutex = PTHREAD_MUTEX_INITIALIZER;
+atomic_int writes_since_compaction;
+int compact_every = 100000; // Writes between checkpoints, bounding the log recovery replays; 0 checkpoints only at exit
+int sync_writes = 0; // fdatasync the log after every record when group commit is off
+int fresh_start = 0; // --fresh: truncate the tables and the log at startup instead of recovering them
+
+// Every log record is "<crc32 of the rest, 8 hex digits> <record>\n"; recovery stops at the first
+// record whose line is torn or whose checksum does not match
+#define WAL_CHECKSUM_WIDTH 9
+unsigned int crc32_table[256];
+
+// Group commit: writers queue their log records and a single flusher makes each batch durable
+int group_commit = 0;
+int commit_batch = 64;          // Most records flushed by a single fdatasync
+long commit_latency_us = 1000;  // Longest a partial batch waits for more writers
+Mutex commit_mutex;
+Condition commit_queued;  // Broadcast when the flusher has work or should stop
+Condition commit_durable; // Broadcast when a batch was taken or reached the disk
+char *commit_buffer;               // Records queued for the next batch
+size_t commit_length;
+size_t commit_capacity;
+int commit_pending;                // Records in commit_buffer
+unsigned long commit_queued_lsn;   // Sequence number of the last queued record
+unsigned long commit_durable_lsn;  // Sequence number of the last record on disk
+int commit_shutdown;
+pthread_t commit_thread;
+long commit_batches;
+long commit_records;
+
+// Log file initialization
+FILE *log_file;
+
+// Asynchronous logger: every thread pushes binary events into its own ring, a background
+// thread merges the rings in sequence order and writes them out
+#define LOG_RING_SIZE 256 // Events per ring, a power of two
+
+typedef enum
+{
+    LOG_READ_START,
+    LOG_READ_END,
+    LOG_WRITE_WAIT,
+    LOG_WRITE_START,
+    LOG_WRITE_END
+} LogEventType;
+
+// Binary log event, also the record format of --log-format=binary
+typedef struct
+{
+    unsigned long sequence; // Global order of the events
+    long long timestamp_ns; // CLOCK_MONOTONIC time of the event
+    int thread_id;
+    short table_id;
+    short type;
+} LogEvent;
+
+// Single-producer single-consumer ring of one thread, head and tail on separate cache lines
+typedef struct
+{
+    atomic_size_t tail; // Written by the owning thread
+    char tail_padding[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    atomic_size_t head; // Written by the log writer
+    char head_padding[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    LogEvent events[LOG_RING_SIZE];
+} LogRing;
+
+LogRing *log_rings;
+int num_log_rings;
+atomic_ulong log_sequence;
+atomic_int log_shutdown;
+int log_binary = 0;
+pthread_t log_thread;
+
+// Function to sleep on a futex word while it still holds the expected value, optionally until
+// an absolute CLOCK_MONOTONIC deadline
+void futex_wait(atomic_int *word, int expected, const struct timespec *deadline)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, expected, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+// Function to wake up to count threads sleeping on a futex word
+void futex_wake(atomic_int *word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+}
+
+// Function to tell the CPU that the calling thread is spinning
+void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Function to initialize a mutex
+void mutex_init(Mutex *mutex)
+{
+    atomic_init(&mutex->state, 0);
+    atomic_init(&mutex->spins, 0);
+    atomic_init(&mutex->tail, NULL);
+    mutex->owner = NULL;
+}
+
+// Function to take an MCS mutex: join the queue, then wait on the thread's own node
+void mcs_lock(Mutex *mutex)
+{
+    McsNode *node = &mcs_nodes[mcs_depth++];
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+
+    McsNode *previous = atomic_exchange(&mutex->tail, node);
+    if (previous)
+    {
+        atomic_store(&previous->next, node);
+
+        // Spin on our own cache line for a while, then sleep until the predecessor hands over
+        for (int i = 0; i < mutex_max_spins && atomic_load_explicit(&node->locked, memory_order_acquire); i++)
+            cpu_relax();
+        int expected = 1;
+        if (atomic_compare_exchange_strong(&node->locked, &expected, 2))
+        {
+            while (atomic_load_explicit(&node->locked, memory_order_acquire) != 0)
+                futex_wait(&node->locked, 2, NULL);
+        }
+    }
+    mutex->owner = node;
+}
+
+// Function to release an MCS mutex to the next node in the queue
+void mcs_unlock(Mutex *mutex)
+{
+    McsNode *node = mutex->owner;
+    mcs_depth--;
+    McsNode *next = atomic_load(&node->next);
+    if (!next)
+    {
+        // Nobody queued: the mutex is free again, unless a thread is just linking itself in
+        McsNode *expected = node;
+        if (atomic_compare_exchange_strong(&mutex->tail, &expected, NULL))
+            return;
+        while (!(next = atomic_load(&node->next)))
+            sched_yield();
+    }
+    if (atomic_exchange(&next->locked, 0) == 2)
+        futex_wake(&next->locked, 1);
+}
+
+// Function to take a mutex. A futex mutex spins for about as long as it took to get the mutex
+// recently before it sleeps, since most critical sections here are a few instructions
+void mutex_lock(Mutex *mutex)
+{
+    if (mutex_kind == MUTEX_MCS)
+    {
+        mcs_lock(mutex);
+        return;
+    }
+
+    int state = 0;
+    if (atomic_compare_exchange_strong(&mutex->state, &state, 1))
+        return;
+
+    int recent = atomic_load_explicit(&mutex->spins, memory_order_relaxed);
+    int limit = recent * 2 + 10 < mutex_max_spins ? recent * 2 + 10 : mutex_max_spins;
+    for (int i = 0; i < limit; i++)
+    {
+        cpu_relax();
+        state = 0;
+        if (atomic_load_explicit(&mutex->state, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&mutex->state, &state, 1))
+        {
+            atomic_store_explicit(&mutex->spins, recent + (i - recent) / 8, memory_order_relaxed);
+            return;
+        }
+    }
+    atomic_store_explicit(&mutex->spins, recent + (limit - recent) / 8, memory_order_relaxed);
+
+    // Mark the mutex contended and sleep until it is free
+    state = atomic_exchange(&mutex->state, 2);
+    while (state != 0)
+    {
+        futex_wait(&mutex->state, 2, NULL);
+        state = atomic_exchange(&mutex->state, 2);
+    }
+}
+
+// Function to release a mutex, waking one sleeper if there may be any
+void mutex_unlock(Mutex *mutex)
+{
+    if (mutex_kind == MUTEX_MCS)
+    {
+        mcs_unlock(mutex);
+        return;
+    }
+    if (atomic_exchange(&mutex->state, 0) == 2)
+        futex_wake(&mutex->state, 1);
+}
+
+// Function to read CLOCK_MONOTONIC in nanoseconds
+long long monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Function to give the worker back to its scheduler until the calling client is made ready again
+void client_park(void)
+{
+    Client *client = current_client;
+    swapcontext(&client->context, &workers[client->worker].scheduler);
+}
+
+// Function to append a client to the ready queue of its worker, from any thread
+void client_make_ready(Client *client)
+{
+    Worker *worker = &workers[client->worker];
+    pthread_mutex_lock(&worker->mutex);
+    client->next = NULL;
+    if (worker->ready_tail)
+        worker->ready_tail->next = client;
+    else
+        worker->ready_head = client;
+    worker->ready_tail = client;
+    pthread_cond_signal(&worker->wakeup);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+// Function to let other clients of the worker run, or other threads of the CPU outside a worker
+void client_yield(void)
+{
+    if (!current_client)
+    {
+        sched_yield();
+        return;
+    }
+    // Only this worker runs the client, so it cannot be resumed before it parked
+    client_make_ready(current_client);
+    client_park();
+}
+
+// Function to add a sleeping client to its worker's heap
+void sleeping_push(Worker *worker, Client *client)
+{
+    if (worker->sleeping_count == worker->sleeping_capacity)
+    {
+        worker->sleeping_capacity = worker->sleeping_capacity ? worker->sleeping_capacity * 2 : 64;
+        worker->sleeping = realloc(worker->sleeping, worker->sleeping_capacity * sizeof(Client *));
+        if (!worker->sleeping)
+        {
+            perror("Error allocating sleeping clients");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sift the client up to its place
+    int i = worker->sleeping_count++;
+    while (i > 0 && client->wake_ns < worker->sleeping[(i - 1) / 2]->wake_ns)
+    {
+        worker->sleeping[i] = worker->sleeping[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    worker->sleeping[i] = client;
+}
+
+// Function to remove the client that wakes up first from its worker's heap
+Client *sleeping_pop(Worker *worker)
+{
+    Client *top = worker->sleeping[0];
+    Client *last = worker->sleeping[--worker->sleeping_count];
+
+    // Sift the last client down from the root
+    int i = 0;
+    while (2 * i + 1 < worker->sleeping_count)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < worker->sleeping_count && worker->sleeping[child + 1]->wake_ns < worker->sleeping[child]->wake_ns)
+            child++;
+        if (worker->sleeping[child]->wake_ns >= last->wake_ns)
+            break;
+        worker->sleeping[i] = worker->sleeping[child];
+        i = child;
+    }
+    worker->sleeping[i] = last;
+    return top;
+}
+
+// Function to sleep until an absolute CLOCK_MONOTONIC time; a client parks instead of blocking its worker
+void client_sleep_until_ns(long long deadline)
+{
+    Client *client = current_client;
+    if (!client)
+    {
+        struct timespec until = {deadline / 1000000000LL, deadline % 1000000000LL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+            ;
+        return;
+    }
+    client->wake_ns = deadline;
+    sleeping_push(&workers[client->worker], client);
+    client_park();
+}
+
+// Function to sleep for a number of nanoseconds
+void client_sleep_ns(long long nanoseconds)
+{
+    if (nanoseconds > 0)
+        client_sleep_until_ns(monotonic_ns() + nanoseconds);
+}
+
+// Function to lock a mutex that may be held across a park. A client polls it, since blocking
+// its worker could keep the parked holder from ever running again
+void client_mutex_lock(pthread_mutex_t *mutex)
+{
+    if (!current_client)
+    {
+        pthread_mutex_lock(mutex);
+        return;
+    }
+    while (pthread_mutex_trylock(mutex) != 0)
+        client_yield();
+}
+
+// Function to initialize a condition
+void condition_init(Condition *condition)
+{
+    atomic_init(&condition->sequence, 0);
+    atomic_init(&condition->waiters, 0);
+    condition->parked_head = NULL;
+    condition->parked_tail = NULL;
+}
+
+// Function to destroy a condition
+void condition_destroy(Condition *condition)
+{
+    (void)condition;
+}
+
+// Function to wait on a condition like pthread_cond_wait: the mutex is released while waiting
+void condition_wait(Condition *condition, Mutex *mutex)
+{
+    Client *client = current_client;
+    if (!client)
+    {
+        // A broadcast after the unlock changes the sequence, so the futex does not go to sleep
+        int sequence = atomic_load(&condition->sequence);
+        atomic_fetch_add(&condition->waiters, 1);
+        mutex_unlock(mutex);
+        futex_wait(&condition->sequence, sequence, NULL);
+        atomic_fetch_sub(&condition->waiters, 1);
+        mutex_lock(mutex);
+        return;
+    }
+
+    // Park on the condition. A broadcast right after the unlock only queues the client on its own
+    // worker, which cannot run it before it switched out
+    client->next = NULL;
+    if (condition->parked_tail)
+        condition->parked_tail->next = client;
+    else
+        condition->parked_head = client;
+    condition->parked_tail = client;
+    mutex_unlock(mutex);
+    client_park();
+    mutex_lock(mutex);
+}
+
+// Function to wait on a condition until an absolute CLOCK_MONOTONIC deadline, for OS threads only.
+// Returns 0 once the deadline passed
+int condition_timed_wait(Condition *condition, Mutex *mutex, long long deadline_ns)
+{
+    if (monotonic_ns() >= deadline_ns)
+        return 0;
+    int sequence = atomic_load(&condition->sequence);
+    atomic_fetch_add(&condition->waiters, 1);
+    mutex_unlock(mutex);
+    struct timespec deadline = {deadline_ns / 1000000000LL, deadline_ns % 1000000000LL};
+    futex_wait(&condition->sequence, sequence, &deadline);
+    atomic_fetch_sub(&condition->waiters, 1);
+    mutex_lock(mutex);
+    return monotonic_ns() < deadline_ns;
+}
+
+// Function to wake every thread and client waiting on a condition; the caller holds the waiters' mutex
+void condition_broadcast(Condition *condition)
+{
+    atomic_fetch_add(&condition->sequence, 1);
+    if (atomic_load(&condition->waiters) > 0)
+        futex_wake(&condition->sequence, INT_MAX);
+    Client *client = condition->parked_head;
+    condition->parked_head = NULL;
+    condition->parked_tail = NULL;
+    while (client)
+    {
+        Client *next = client->next;
+        client_make_ready(client);
+        client = next;
+    }
+}
+
+// Function to initialize the lock of a table
+void table_lock_init(TableLock *lock)
+{
+    memset(lock, 0, sizeof(TableLock));
+    mutex_init(&lock->mutex);
+    condition_init(&lock->changed);
+    atomic_init(&lock->writers_pending, 0);
+
+    lock->shards = aligned_alloc(CACHE_LINE_SIZE, num_reader_shards * sizeof(ReaderShard));
+    if (!lock->shards)
+    {
+        perror("Error allocating reader counters");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_reader_shards; i++)
+    {
+        atomic_init(&lock->shards[i].count, 0);
+    }
+}
+
+// Function to destroy the lock of a table
+void table_lock_destroy(TableLock *lock)
+{
+    condition_destroy(&lock->changed);
+    free(lock->shards);
+}
+
+// Function to count the readers currently inside the table
+int active_readers(TableLock *lock)
+{
+    int readers = 0;
+    for (int i = 0; i < num_reader_shards; i++)
+    {
+        readers += atomic_load(&lock->shards[i].count);
+    }
+    return readers;
+}
+
+// Function to wake up the waiters of a lock after a reader left
+void wake_waiters(TableLock *lock)
+{
+    mutex_lock(&lock->mutex);
+    condition_broadcast(&lock->changed);
+    mutex_unlock(&lock->mutex);
+}
+
+// Function to acquire a table for reading, returns the reader shard to pass to release_read
+int acquire_read(TableLock *lock)
+{
+    int cpu = sched_getcpu();
+    int shard = (cpu < 0 ? 0 : cpu) % num_reader_shards;
+
+    // Fast path: with no writer around a reader only touches its own shard
+    if (atomic_load(&lock->writers_pending) == 0)
+    {
+        atomic_fetch_add(&lock->shards[shard].count, 1);
+        if (atomic_load(&lock->writers_pending) == 0)
+            return shard;
+
+        // A writer arrived in between: back out, it may already be waiting for us to leave
+        atomic_fetch_sub(&lock->shards[shard].count, 1);
+        wake_waiters(lock);
+    }
+
+    // Slow path: wait until the policy lets this reader in
+    mutex_lock(&lock->mutex);
+    if (lock_policy == POLICY_WRITER_PREFERENCE)
+    {
+        while (atomic_load(&lock->writers_pending) > 0)
+            condition_wait(&lock->changed, &lock->mutex);
+    }
+    else if (lock_policy == POLICY_FIFO)
+    {
+        // Queue behind everybody who arrived earlier, then let the next ticket in as well
+        unsigned long ticket = lock->next_ticket++;
+        while (lock->serving != ticket || lock->writer_active)
+            condition_wait(&lock->changed, &lock->mutex);
+        lock->serving++;
+    }
+    else if (atomic_load(&lock->writers_pending) > 0)
+    {
+        // Phase-fair: wait for the end of the current write phase, the writer then admits us
+        unsigned long phase = lock->phase;
+        lock->readers_waiting++;
+        while (lock->phase == phase)
+            condition_wait(&lock->changed, &lock->mutex);
+        lock->readers_admitted--;
+    }
+    atomic_fetch_add(&lock->shards[shard].count, 1);
+    condition_broadcast(&lock->changed);
+    mutex_unlock(&lock->mutex);
+    return shard;
+}
+
+// Function to release a table after reading
+void release_read(TableLock *lock, int shard)
+{
+    atomic_fetch_sub(&lock->shards[shard].count, 1);
+
+    // Only a waiting writer cares about readers leaving
+    if (atomic_load(&lock->writers_pending) > 0)
+        wake_waiters(lock);
+}
+
+// Function to acquire a table for writing
+void acquire_write(TableLock *lock)
+{
+    mutex_lock(&lock->mutex);
+
+    // Announce the writer first, so no new reader takes the fast path
+    atomic_fetch_add(&lock->writers_pending, 1);
+    if (lock_policy == POLICY_FIFO)
+    {
+        unsigned long ticket = lock->next_ticket++;
+        while (lock->serving != ticket || lock->writer_active)
+            condition_wait(&lock->changed, &lock->mutex);
+        lock->serving++;
+    }
+    else
+    {
+        // Phase-fair: the readers admitted by the previous writer go first
+        while (lock->writer_active || lock->readers_admitted > 0)
+            condition_wait(&lock->changed, &lock->mutex);
+    }
+    lock->writer_active = 1;
+
+    // Wait for the readers that are already inside to leave
+    while (active_readers(lock) > 0)
+        condition_wait(&lock->changed, &lock->mutex);
+    mutex_unlock(&lock->mutex);
+}
+
+// Function to release a table after writing
+void release_write(TableLock *lock)
+{
+    mutex_lock(&lock->mutex);
+    lock->writer_active = 0;
+    atomic_fetch_sub(&lock->writers_pending, 1);
+
+    // Phase-fair: start a read phase for every reader that waited during this write
+    lock->phase++;
+    lock->readers_admitted += lock->readers_waiting;
+    lock->readers_waiting = 0;
+
+    condition_broadcast(&lock->changed);
+    mutex_unlock(&lock->mutex);
+}
+
+// Funtion to create file with given filename
+void create_file(const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Error creating table: %s\n", filename);
+        perror("Error");
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+}
+
+// Function to write a whole buffer to a file descriptor, retrying partial writes
+void write_all(int fd, const char *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, buffer, size);
+        if (written <= 0)
+        {
+            perror("Error writing");
+            exit(EXIT_FAILURE);
+        }
+        buffer += written;
+        size -= written;
+    }
+}
+
+// Function to enter a read-side critical section: pointers loaded afterwards stay valid until epoch_exit
+void epoch_enter(void)
+{
+    atomic_store(&epoch_slots[thread_slot].epoch, atomic_load(&global_epoch));
+}
+
+// Function to leave a read-side critical section
+void epoch_exit(void)
+{
+    atomic_store(&epoch_slots[thread_slot].epoch, 0);
+}
+
+// Function to move the global epoch forward once every thread inside has observed the current one
+void epoch_try_advance(void)
+{
+    unsigned long epoch = atomic_load(&global_epoch);
+    for (int i = 0; i < num_epoch_slots; i++)
+    {
+        unsigned long observed = atomic_load(&epoch_slots[i].epoch);
+        if (observed != 0 && observed != epoch)
+            return;
+    }
+    atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+}
+
+// Function to free a pointer that is no longer reachable once the epoch has moved on twice
+void epoch_retire(void *pointer)
+{
+    EpochSlot *slot = &epoch_slots[thread_slot];
+    Retired *node = malloc(sizeof(Retired));
+    if (!node)
+    {
+        perror("Error allocating retired node");
+        exit(EXIT_FAILURE);
+    }
+    node->pointer = pointer;
+    node->epoch = atomic_load(&global_epoch);
+    node->next = NULL;
+    if (slot->retired_tail)
+        slot->retired_tail->next = node;
+    else
+        slot->retired_head = node;
+    slot->retired_tail = node;
+
+    // Readers that could see a pointer retired in epoch e have left by the time the epoch is e + 2
+    epoch_try_advance();
+    unsigned long safe = atomic_load(&global_epoch);
+    while (slot->retired_head && slot->retired_head->epoch + 2 <= safe)
+    {
+        Retired *done = slot->retired_head;
+        slot->retired_head = done->next;
+        free(done->pointer);
+        free(done);
+    }
+    if (!slot->retired_head)
+        slot->retired_tail = NULL;
+}
+
+// Function to publish a new version of a table with one more row, called with the table's write lock held
+int version_append(int table_id, const char *value)
+{
+    TableVersion *previous = atomic_load(&table_versions[table_id]);
+    TableVersion *version = malloc(sizeof(TableVersion));
+    if (!version)
+    {
+        perror("Error allocating table version");
+        exit(EXIT_FAILURE);
+    }
+    *version = *previous;
+
+    // Readers of older versions only look below their own row count, so the new row can go into the
+    // shared array; a full array is copied and the old one retired
+    if (version->row_count == version->row_capacity)
+    {
+        version->row_capacity = version->row_capacity ? version->row_capacity * 2 : 16;
+        version->rows = malloc(version->row_capacity * sizeof(char *));
+        if (!version->rows)
+        {
+            perror("Error allocating rows");
+            exit(EXIT_FAILURE);
+        }
+        if (previous->row_count > 0)
+            memcpy(version->rows, previous->rows, previous->row_count * sizeof(char *));
+        if (previous->rows)
+            epoch_retire(previous->rows);
+    }
+    version->rows[version->row_count] = strdup(value);
+    version->row_count++;
+    version->commit_ts = atomic_fetch_add(&commit_clock, 1) + 1;
+
+    atomic_store(&table_versions[table_id], version);
+    epoch_retire(previous);
+    return version->row_count - 1;
+}
+
+// Function to read the rows of a snapshot, called inside an epoch that loaded the snapshot
+int read_snapshot(const TableVersion *version, char ***rows)
+{
+    *rows = version->rows;
+    atomic_fetch_add(&rows_read, version->row_count);
+    return version->row_count;
+}
+
+// Function to append a row to the in-memory table, called with the table's write lock held
+int store_append(int table_id, const char *value)
+{
+    TableStore *store = &table_stores[table_id];
+    if (store->row_count == store->row_capacity)
+    {
+        store->row_capacity = store->row_capacity ? store->row_capacity * 2 : 16;
+        store->rows = realloc(store->rows, store->row_capacity * sizeof(char *));
+        if (!store->rows)
+        {
+            perror("Error allocating rows");
+            exit(EXIT_FAILURE);
+        }
+    }
+    store->rows[store->row_count] = strdup(value);
+    return store->row_count++;
+}
+
+// Function to read the rows of the in-memory table, called with the table's read lock held.
+// Returns the row count and a view of the rows that stays valid until the lock is released
+int read_table(int table_id, char ***rows)
+{
+    TableStore *store = &table_stores[table_id];
+    *rows = store->rows;
+    atomic_fetch_add(&rows_read, store->row_count);
+    return store->row_count;
+}
+
+// Function to allocate the frames of the buffer pool and the files it reads from
+void pool_init(int num_tables)
+{
+    buffer_frames = malloc(buffer_pool_pages * sizeof(BufferFrame));
+    num_buffer_buckets = buffer_pool_pages * 2;
+    buffer_buckets = malloc(num_buffer_buckets * sizeof(int));
+    table_files = calloc(num_tables, sizeof(TableFile));
+    if (!buffer_frames || !buffer_buckets || !table_files)
+    {
+        perror("Error allocating buffer pool");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < buffer_pool_pages; i++)
+    {
+        buffer_frames[i].table_id = -1;
+        buffer_frames[i].pins = 0;
+        buffer_frames[i].referenced = 0;
+        buffer_frames[i].loading = 0;
+        buffer_frames[i].next = -1;
+    }
+    for (int i = 0; i < num_buffer_buckets; i++)
+        buffer_buckets[i] = -1;
+    for (int i = 0; i < num_tables; i++)
+    {
+        pthread_rwlock_init(&table_files[i].lock, NULL);
+        table_files[i].fd = -1;
+    }
+    mutex_init(&pool_mutex);
+    condition_init(&pool_changed);
+}
+
+// Function to free the buffer pool and close the table files
+void pool_destroy(int num_tables)
+{
+    for (int i = 0; i < num_tables; i++)
+    {
+        if (table_files[i].fd >= 0)
+            close(table_files[i].fd);
+        pthread_rwlock_destroy(&table_files[i].lock);
+    }
+    condition_destroy(&pool_changed);
+    free(table_files);
+    free(buffer_buckets);
+    free(buffer_frames);
+}
+
+// Function to point the reads of a table at its file after it was loaded or checkpointed with the given rows
+void table_file_swap(int table_id, const char *filename, int rows, long bytes)
+{
+    if (buffer_pool_pages <= 0)
+        return;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening table");
+        exit(EXIT_FAILURE);
+    }
+    TableFile *file = &table_files[table_id];
+
+    // A reader of the file may be a client parked on this worker, so the worker must not block
+    while (pthread_rwlock_trywrlock(&file->lock) != 0)
+        client_yield();
+    if (file->fd >= 0)
+        close(file->fd);
+    file->fd = fd;
+    file->generation++;
+    file->rows = rows;
+    file->bytes = bytes;
+    pthread_rwlock_unlock(&file->lock);
+}
+
+// Function to find the hash bucket of a page
+int pool_bucket(int table_id, unsigned long generation, long page_number)
+{
+    unsigned long hash = ((unsigned long)table_id * 0x9E3779B97F4A7C15UL) ^ (generation * 0xC2B2AE3D27D4EB4FUL) ^ page_number;
+    hash ^= hash >> 29;
+    return hash % num_buffer_buckets;
+}
+
+// Function to remove a frame from its hash bucket, called with pool_mutex held
+void pool_unlink(int index)
+{
+    BufferFrame *frame = &buffer_frames[index];
+    int *link = &buffer_buckets[pool_bucket(frame->table_id, frame->generation, frame->page_number)];
+    while (*link != index)
+        link = &buffer_frames[*link].next;
+    *link = frame->next;
+}
+
+// Function to pin a page of a table file, reading it from disk on a miss. Called with the file's read lock held.
+// Victims are chosen with CLOCK: the hand skips pinned frames and clears the reference bit of referenced ones
+BufferFrame *pool_pin(int table_id, const TableFile *file, long page_number)
+{
+    int bucket = pool_bucket(table_id, file->generation, page_number);
+    mutex_lock(&pool_mutex);
+    while (1)
+    {
+        for (int index = buffer_buckets[bucket]; index >= 0; index = buffer_frames[index].next)
+        {
+            BufferFrame *frame = &buffer_frames[index];
+            if (frame->table_id == table_id && frame->generation == file->generation && frame->page_number == page_number)
+            {
+                frame->pins++;
+                frame->referenced = 1;
+                pool_hits++;
+                while (frame->loading)
+                    condition_wait(&pool_changed, &pool_mutex);
+                mutex_unlock(&pool_mutex);
+                return frame;
+            }
+        }
+
+        // Two turns of the hand find an unpinned frame if there is one
+        int victim = -1;
+        for (int step = 0; step < 2 * buffer_pool_pages && victim < 0; step++)
+        {
+            BufferFrame *frame = &buffer_frames[clock_hand];
+            if (frame->pins == 0 && !frame->referenced)
+                victim = clock_hand;
+            else if (frame->pins == 0)
+                frame->referenced = 0;
+            clock_hand = (clock_hand + 1) % buffer_pool_pages;
+        }
+        if (victim >= 0)
+        {
+            BufferFrame *frame = &buffer_frames[victim];
+            if (frame->table_id >= 0)
+            {
+                pool_unlink(victim);
+                pool_evictions++;
+            }
+            frame->table_id = table_id;
+            frame->generation = file->generation;
+            frame->page_number = page_number;
+            frame->pins = 1;
+            frame->referenced = 1;
+            frame->loading = 1;
+            frame->next = buffer_buckets[bucket];
+            buffer_buckets[bucket] = victim;
+            pool_misses++;
+            mutex_unlock(&pool_mutex);
+
+            // Read outside the pool mutex; readers of the same page wait for loading to clear
+            long offset = page_number * POOL_PAGE_SIZE;
+            long length = file->bytes - offset < POOL_PAGE_SIZE ? file->bytes - offset : POOL_PAGE_SIZE;
+            if (pread(file->fd, frame->data, length, offset) != length)
+            {
+                perror("Error reading table page");
+                exit(EXIT_FAILURE);
+            }
+            frame->length = length;
+
+            mutex_lock(&pool_mutex);
+            frame->loading = 0;
+            condition_broadcast(&pool_changed);
+            mutex_unlock(&pool_mutex);
+            return frame;
+        }
+
+        // Every frame is pinned: wait for a reader to let one go, then look again
+        pool_waiters++;
+        condition_wait(&pool_changed, &pool_mutex);
+        pool_waiters--;
+    }
+}
+
+// Function to give up a pinned page
+void pool_unpin(BufferFrame *frame)
+{
+    mutex_lock(&pool_mutex);
+    frame->pins--;
+    if (frame->pins == 0 && pool_waiters > 0)
+        condition_broadcast(&pool_changed);
+    mutex_unlock(&pool_mutex);
+}
+
+// Function to read a whole table through the buffer pool, called with the table's read lock held.
+// Counts the rows in the file's pages, then adds the rows written since the checkpoint
+int pool_read_table(int table_id)
+{
+    TableFile *file = &table_files[table_id];
+    int rows = 0;
+    pthread_rwlock_rdlock(&file->lock);
+    for (long page = 0; page * POOL_PAGE_SIZE < file->bytes; page++)
+    {
+        BufferFrame *frame = pool_pin(table_id, file, page);
+        for (const char *line = frame->data; (line = memchr(line, '\n', frame->data + frame->length - line)); line++)
+            rows++;
+        pool_unpin(frame);
+    }
+    if (table_stores[table_id].row_count > file->rows)
+        rows += table_stores[table_id].row_count - file->rows;
+    pthread_rwlock_unlock(&file->lock);
+    atomic_fetch_add(&rows_read, rows);
+    return rows;
+}
+
+// Function to allocate an empty B+-tree node
+BTreeNode *btree_new_node(int leaf)
+{
+    BTreeNode *node = calloc(1, sizeof(BTreeNode));
+    if (!node)
+    {
+        perror("Error allocating index node");
+        exit(EXIT_FAILURE);
+    }
+    node->leaf = leaf;
+    return node;
+}
+
+// Function to find the first position in a node whose key is not below the given key
+int btree_lower_bound(const BTreeNode *node, int key)
+{
+    int low = 0;
+    int high = node->count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (node->keys[middle] < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// Function to find the child of an internal node that covers a key
+int btree_child(const BTreeNode *node, int key)
+{
+    int position = btree_lower_bound(node, key);
+    if (position < node->count && node->keys[position] == key)
+        position++;
+    return position;
+}
+
+// Function to walk down to the leaf that covers a key
+BTreeNode *btree_find_leaf(BTreeNode *node, int key)
+{
+    while (node && !node->leaf)
+        node = node->children[btree_child(node, key)];
+    return node;
+}
+
+// Function to insert a key into a subtree. Returns the new right half if the node had to split,
+// with the first key of that half in *split_key
+BTreeNode *btree_insert(BTreeNode *node, int key, char *value, unsigned long version, int *split_key, int *added)
+{
+    int position = btree_lower_bound(node, key);
+    if (node->leaf)
+    {
+        // An existing key just gets the new value
+        if (position < node->count && node->keys[position] == key)
+        {
+            free(node->values[position]);
+            node->values[position] = value;
+            node->versions[position] = version;
+            return NULL;
+        }
+        memmove(&node->keys[position + 1], &node->keys[position], (node->count - position) * sizeof(int));
+        memmove(&node->values[position + 1], &node->values[position], (node->count - position) * sizeof(char *));
+        memmove(&node->versions[position + 1], &node->versions[position], (node->count - position) * sizeof(unsigned long));
+        node->keys[position] = key;
+        node->values[position] = value;
+        node->versions[position] = version;
+        node->node_version = version;
+        node->count++;
+        *added = 1;
+    }
+    else
+    {
+        position = btree_child(node, key);
+        int child_split_key;
+        BTreeNode *right = btree_insert(node->children[position], key, value, version, &child_split_key, added);
+        if (!right)
+            return NULL;
+
+        // The child split, add its right half next to it
+        memmove(&node->keys[position + 1], &node->keys[position], (node->count - position) * sizeof(int));
+        memmove(&node->children[position + 2], &node->children[position + 1], (node->count - position) * sizeof(BTreeNode *));
+        node->keys[position] = child_split_key;
+        node->children[position + 1] = right;
+        node->count++;
+    }
+
+    if (node->count < BTREE_ORDER)
+        return NULL;
+
+    // Split the full node in two halves
+    BTreeNode *right = btree_new_node(node->leaf);
+    int half = node->count / 2;
+    if (node->leaf)
+    {
+        right->count = node->count - half;
+        memcpy(right->keys, &node->keys[half], right->count * sizeof(int));
+        memcpy(right->values, &node->values[half], right->count * sizeof(char *));
+        memcpy(right->versions, &node->versions[half], right->count * sizeof(unsigned long));
+        right->next = node->next;
+        right->node_version = version;
+        node->next = right;
+        *split_key = right->keys[0];
+    }
+    else
+    {
+        // The middle key moves up and separates the halves
+        *split_key = node->keys[half];
+        right->count = node->count - half - 1;
+        memcpy(right->keys, &node->keys[half + 1], right->count * sizeof(int));
+        memcpy(right->children, &node->children[half + 1], (right->count + 1) * sizeof(BTreeNode *));
+    }
+    node->count = half;
+    return right;
+}
+
+// Function to free a subtree and its values
+void btree_free(BTreeNode *node)
+{
+    if (!node)
+        return;
+    for (int i = 0; i < node->count; i++)
+    {
+        if (node->leaf)
+            free(node->values[i]);
+    }
+    if (!node->leaf)
+    {
+        for (int i = 0; i <= node->count; i++)
+            btree_free(node->children[i]);
+    }
+    free(node);
+}
+
+// Function to insert or replace a key, called with the table's write lock held
+void index_put(int table_id, int key, const char *value)
+{
+    TableStore *store = &table_stores[table_id];
+    if (!store->index)
+        store->index = btree_new_node(1);
+
+    int split_key;
+    int added = 0;
+    unsigned long version = atomic_fetch_add(&commit_clock, 1) + 1;
+    BTreeNode *right = btree_insert(store->index, key, strdup(value), version, &split_key, &added);
+    if (right)
+    {
+        // The root split, the tree grows by one level
+        BTreeNode *root = btree_new_node(0);
+        root->count = 1;
+        root->keys[0] = split_key;
+        root->children[0] = store->index;
+        root->children[1] = right;
+        store->index = root;
+    }
+    store->key_count += added;
+    if (added)
+        store->key_set_version = version;
+}
+
+// Function to remove a key, called with the table's write lock held. Returns 1 if the key existed.
+// Leaves are not merged when they run empty; separators stay valid for routing
+int index_delete(int table_id, int key)
+{
+    TableStore *store = &table_stores[table_id];
+    BTreeNode *leaf = btree_find_leaf(store->index, key);
+    if (!leaf)
+        return 0;
+
+    int position = btree_lower_bound(leaf, key);
+    if (position == leaf->count || leaf->keys[position] != key)
+        return 0;
+    free(leaf->values[position]);
+    memmove(&leaf->keys[position], &leaf->keys[position + 1], (leaf->count - position - 1) * sizeof(int));
+    memmove(&leaf->values[position], &leaf->values[position + 1], (leaf->count - position - 1) * sizeof(char *));
+    memmove(&leaf->versions[position], &leaf->versions[position + 1], (leaf->count - position - 1) * sizeof(unsigned long));
+    leaf->count--;
+    store->key_count--;
+    store->key_set_version = atomic_fetch_add(&commit_clock, 1) + 1;
+    leaf->node_version = store->key_set_version;
+    return 1;
+}
+
+// Function to look up a key, called with the table's read lock held. Returns NULL if it does not exist
+const char *index_get(int table_id, int key)
+{
+    BTreeNode *leaf = btree_find_leaf(table_stores[table_id].index, key);
+    if (!leaf)
+        return NULL;
+
+    int position = btree_lower_bound(leaf, key);
+    if (position == leaf->count || leaf->keys[position] != key)
+        return NULL;
+    atomic_fetch_add(&rows_read, 1);
+    return leaf->values[position];
+}
+
+// Function to read the keys from low to high, called with the table's read lock held.
+// Returns the number of keys in the range
+int index_scan(int table_id, int low, int high)
+{
+    BTreeNode *leaf = btree_find_leaf(table_stores[table_id].index, low);
+    int position = leaf ? btree_lower_bound(leaf, low) : 0;
+    int found = 0;
+
+    // Walk the leaf chain until the first key above the range
+    while (leaf)
+    {
+        for (; position < leaf->count; position++)
+        {
+            if (leaf->keys[position] > high)
+            {
+                atomic_fetch_add(&rows_read, found);
+                return found;
+            }
+            found++;
+        }
+        leaf = leaf->next;
+        position = 0;
+    }
+    atomic_fetch_add(&rows_read, found);
+    return found;
+}
+
+// Function to get the version of a key for validation, called with the table's latch or lock held.
+// A missing key reports the version of the leaf it would go into, with the top bit set: inserting
+// the key changes that version, and a split moves the key to a leaf with a newer version
+unsigned long index_version(int table_id, int key)
+{
+    TableStore *store = &table_stores[table_id];
+    BTreeNode *leaf = btree_find_leaf(store->index, key);
+    if (!leaf)
+        return store->key_set_version | (1UL << 63);
+    int position = btree_lower_bound(leaf, key);
+    if (position < leaf->count && leaf->keys[position] == key)
+        return leaf->versions[position];
+    return leaf->node_version | (1UL << 63);
+}
+
+// Function to get the version of a key range for validation: any write, insert or delete in the
+// range makes it larger, since commit timestamps only grow
+unsigned long index_range_version(int table_id, int low, int high)
+{
+    TableStore *store = &table_stores[table_id];
+    unsigned long version = store->index ? 0 : store->key_set_version;
+    BTreeNode *leaf = btree_find_leaf(store->index, low);
+    int position = leaf ? btree_lower_bound(leaf, low) : 0;
+
+    // Every leaf the range reaches into counts, so does the leaf holding the first key past it
+    for (; leaf; leaf = leaf->next, position = 0)
+    {
+        if (leaf->node_version > version)
+            version = leaf->node_version;
+        for (; position < leaf->count; position++)
+        {
+            if (leaf->keys[position] > high)
+                return version;
+            if (leaf->versions[position] > version)
+                version = leaf->versions[position];
+        }
+    }
+    return version;
+}
+
+// Function to check whether an operation changes the table
+int is_write_operation(OperationType type)
+{
+    return type == OP_WRITE || type == OP_PUT || type == OP_DELETE;
+}
+
+// Function to apply a read-side activity to its table, called with the table's read lock held
+void apply_read(const Activity *activity)
+{
+    int table_id = activity->table_id - 1;
+    char **rows;
+    const char *value;
+    switch (activity->operation_type)
+    {
+    case OP_READ:
+        if (buffer_pool_pages > 0)
+            reply_count = pool_read_table(table_id);
+        else
+            reply_count = read_table(table_id, &rows);
+        break;
+    case OP_GET:
+        value = index_get(table_id, activity->key);
+        reply_count = value != NULL;
+        if (collect_reply && value)
+            reply_value = strdup(value);
+        break;
+    case OP_SCAN:
+        reply_count = index_scan(table_id, activity->key, activity->key_end);
+        break;
+    default:
+        break;
+    }
+}
+
+// Function to apply a write-side activity to its table, called with the table's write lock held.
+// Returns the row of an appended value
+int apply_write(const Activity *activity)
+{
+    int table_id = activity->table_id - 1;
+    switch (activity->operation_type)
+    {
+    case OP_WRITE:
+        reply_count = mvcc ? version_append(table_id, activity->written_value) : store_append(table_id, activity->written_value);
+        return reply_count;
+    case OP_PUT:
+        index_put(table_id, activity->key, activity->written_value);
+        break;
+    case OP_DELETE:
+        reply_count = index_delete(table_id, activity->key);
+        break;
+    default:
+        break;
+    }
+    return -1;
+}
+
+// Function to check whether two lock modes can be held together
+int lock_compatible(LockMode a, LockMode b)
+{
+    static const int compatible[5][5] = {
+        //          NONE IS IX S  X
+        /* NONE */ {1, 1, 1, 1, 1},
+        /* IS   */ {1, 1, 1, 1, 0},
+        /* IX   */ {1, 1, 1, 0, 0},
+        /* S    */ {1, 1, 0, 1, 0},
+        /* X    */ {1, 0, 0, 0, 0},
+    };
+    return compatible[a][b];
+}
+
+// Function to check whether two requests on the same table conflict, on the table or on shared keys
+int requests_conflict(const LockRequest *a, const LockRequest *b)
+{
+    // Requests of the same transaction share its timestamp and never conflict with each other
+    if (a->timestamp != 0 && a->timestamp == b->timestamp)
+        return 0;
+    if (!lock_compatible(a->table_mode, b->table_mode))
+        return 1;
+    if (a->key_mode == LOCK_NONE || b->key_mode == LOCK_NONE)
+        return 0;
+    if (a->high < b->low || b->high < a->low)
+        return 0;
+    return !lock_compatible(a->key_mode, b->key_mode);
+}
+
+// Function to fill in the locks an activity needs: whole-table operations lock the table,
+// key operations take an intention lock on the table and lock their key or range
+void lock_request_init(LockRequest *request, const Activity *activity, unsigned long timestamp)
+{
+    request->timestamp = timestamp;
+    request->key_mode = LOCK_NONE;
+    request->low = activity->key;
+    request->high = activity->operation_type == OP_SCAN ? activity->key_end : activity->key;
+    request->next = NULL;
+    switch (activity->operation_type)
+    {
+    case OP_READ:
+        request->table_mode = LOCK_S;
+        break;
+    case OP_WRITE:
+        request->table_mode = LOCK_X;
+        break;
+    case OP_GET:
+    case OP_SCAN:
+        request->table_mode = LOCK_IS;
+        request->key_mode = LOCK_S;
+        break;
+    default:
+        request->table_mode = LOCK_IX;
+        request->key_mode = LOCK_X;
+        break;
+    }
+}
+
+// Function to initialize the lock manager of a table
+void lock_manager_init(TableLockManager *manager)
+{
+    mutex_init(&manager->mutex);
+    condition_init(&manager->released);
+    pthread_rwlock_init(&manager->latch, NULL);
+    manager->granted = NULL;
+}
+
+// Function to destroy the lock manager of a table
+void lock_manager_destroy(TableLockManager *manager)
+{
+    condition_destroy(&manager->released);
+    pthread_rwlock_destroy(&manager->latch);
+}
+
+// Function to take the locks of a request. Wait-die: a request waits only for younger holders;
+// if an older request holds a conflicting lock it dies and 0 is returned, so it can never be part of a cycle
+int lock_manager_acquire(TableLockManager *manager, LockRequest *request)
+{
+    mutex_lock(&manager->mutex);
+    while (1)
+    {
+        int conflict = 0;
+        int older_holder = 0;
+        for (LockRequest *holder = manager->granted; holder; holder = holder->next)
+        {
+            if (requests_conflict(request, holder))
+            {
+                conflict = 1;
+                if (holder->timestamp < request->timestamp)
+                    older_holder = 1;
+            }
+        }
+
+        if (!conflict)
+        {
+            request->next = manager->granted;
+            manager->granted = request;
+            mutex_unlock(&manager->mutex);
+            return 1;
+        }
+        if (older_holder)
+        {
+            mutex_unlock(&manager->mutex);
+            return 0;
+        }
+        condition_wait(&manager->released, &manager->mutex);
+    }
+}
+
+// Function to give up the locks of a request and wake the waiters
+void lock_manager_release(TableLockManager *manager, LockRequest *request)
+{
+    mutex_lock(&manager->mutex);
+    LockRequest **link = &manager->granted;
+    while (*link != request)
+        link = &(*link)->next;
+    *link = request->next;
+    condition_broadcast(&manager->released);
+    mutex_unlock(&manager->mutex);
+}
+
+// Function to apply a write under the table's latch, so lock-free transaction reads never see it half done
+int apply_write_latched(const Activity *activity)
+{
+    TableLockManager *manager = &lock_managers[activity->table_id - 1];
+    pthread_rwlock_wrlock(&manager->latch);
+    int row = apply_write(activity);
+    pthread_rwlock_unlock(&manager->latch);
+    return row;
+}
+
+// Function to apply a read under the table's latch
+void apply_read_latched(const Activity *activity)
+{
+    TableLockManager *manager = &lock_managers[activity->table_id - 1];
+    pthread_rwlock_rdlock(&manager->latch);
+    apply_read(activity);
+    pthread_rwlock_unlock(&manager->latch);
+}
+
+// Function to find the owner of a table in shared-nothing mode
+TableOwner *table_owner(int table_id)
+{
+    return &owners[table_id % num_owners];
+}
+
+// Function to wake an owner that may be asleep waiting for requests
+void owner_notify(TableOwner *owner)
+{
+    if (atomic_load(&owner->sleeping))
+    {
+        atomic_fetch_add(&owner->doorbell, 1);
+        futex_wake(&owner->doorbell, 1);
+    }
+}
+
+// Function to stop the owner of a table between two requests, so its tables can be read
+void owner_pause(int table_id)
+{
+    TableOwner *owner = table_owner(table_id);
+    atomic_store(&owner->pause, 1);
+    owner_notify(owner);
+    while (!atomic_load(&owner->paused))
+        futex_wait(&owner->paused, 0, NULL);
+}
+
+// Function to let a paused owner go on
+void owner_resume(int table_id)
+{
+    TableOwner *owner = table_owner(table_id);
+    atomic_store(&owner->pause, 0);
+    futex_wake(&owner->pause, 1);
+}
+
+// Function to keep all writers out of a table while it is written to disk. Returns the reader shard
+// to release with unlock_table_for_snapshot
+int lock_table_for_snapshot(int table_id, LockRequest *request)
+{
+    // Shared-nothing: nobody but the owner touches the table, so stopping the owner is enough
+    if (owners)
+    {
+        owner_pause(table_id);
+        return 0;
+    }
+    if (lock_granularity == GRANULARITY_KEY)
+    {
+        // The oldest possible request never dies
+        request->timestamp = 0;
+        request->table_mode = LOCK_S;
+        request->key_mode = LOCK_NONE;
+        lock_manager_acquire(&lock_managers[table_id], request);
+        return 0;
+    }
+    return acquire_read(&table_locks[table_id]);
+}
+
+// Function to let the writers of a table back in after a snapshot
+void unlock_table_for_snapshot(int table_id, LockRequest *request, int shard)
+{
+    if (owners)
+        owner_resume(table_id);
+    else if (lock_granularity == GRANULARITY_KEY)
+        lock_manager_release(&lock_managers[table_id], request);
+    else
+        release_read(&table_locks[table_id], shard);
+}
+
+// Function to open a fresh write-ahead log
+void wal_open(void)
+{
+    wal_fd = open(WAL_FILENAME, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (wal_fd < 0)
+    {
+        perror("Error opening write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to queue a log record for the flusher. Returns its log sequence number for commit_wait
+unsigned long commit_record(const char *record, size_t length)
+{
+    mutex_lock(&commit_mutex);
+
+    // A full batch must be taken by the flusher before it can grow again
+    while (commit_pending >= commit_batch)
+        condition_wait(&commit_durable, &commit_mutex);
+
+    if (commit_length + length > commit_capacity)
+    {
+        while (commit_length + length > commit_capacity)
+            commit_capacity = commit_capacity ? commit_capacity * 2 : 4096;
+        commit_buffer = realloc(commit_buffer, commit_capacity);
+        if (!commit_buffer)
+        {
+            perror("Error allocating commit buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(commit_buffer + commit_length, record, length);
+    commit_length += length;
+    commit_pending++;
+    unsigned long lsn = ++commit_queued_lsn;
+
+    // Wake the flusher when a group starts or fills up
+    if (commit_pending == 1 || commit_pending == commit_batch)
+        condition_broadcast(&commit_queued);
+
+    mutex_unlock(&commit_mutex);
+    return lsn;
+}
+
+// Function to wait until the group holding a queued record is on disk
+void commit_wait(unsigned long lsn)
+{
+    mutex_lock(&commit_mutex);
+    while (commit_durable_lsn < lsn)
+        condition_wait(&commit_durable, &commit_mutex);
+    mutex_unlock(&commit_mutex);
+}
+
+// Flusher thread: writes each group of queued records with one write() and one fdatasync
+void *commit_flusher(void *arg)
+{
+    (void)arg;
+    char *group = NULL;
+    size_t group_capacity = 0;
+
+    mutex_lock(&commit_mutex);
+    while (1)
+    {
+        while (commit_pending == 0 && !commit_shutdown)
+            condition_wait(&commit_queued, &commit_mutex);
+        if (commit_pending == 0)
+            break;
+
+        // Give more writers a chance to join the group, up to the latency bound
+        if (commit_pending < commit_batch && !commit_shutdown && commit_latency_us > 0)
+        {
+            long long deadline = monotonic_ns() + commit_latency_us * 1000LL;
+            while (commit_pending < commit_batch && !commit_shutdown &&
+                   condition_timed_wait(&commit_queued, &commit_mutex, deadline))
+                ;
+        }
+
+        // Take the whole queue as one group and hand writers an empty buffer
+        char *swap = commit_buffer;
+        size_t swap_capacity = commit_capacity;
+        size_t group_length = commit_length;
+        unsigned long group_lsn = commit_queued_lsn;
+        commit_buffer = group;
+        commit_capacity = group_capacity;
+        group = swap;
+        group_capacity = swap_capacity;
+        commit_records += commit_pending;
+        commit_batches++;
+        commit_length = 0;
+        commit_pending = 0;
+        condition_broadcast(&commit_durable);
+        mutex_unlock(&commit_mutex);
+
+        pthread_rwlock_rdlock(&wal_lock);
+        write_all(wal_fd, group, group_length);
+        fdatasync(wal_fd);
+        pthread_rwlock_unlock(&wal_lock);
+
+        // Everyone in the group is durable now
+        mutex_lock(&commit_mutex);
+        commit_durable_lsn = group_lsn;
+        condition_broadcast(&commit_durable);
+    }
+    mutex_unlock(&commit_mutex);
+
+    free(group);
+    return NULL;
+}
+
+// Function to flush the remaining records and stop the flusher
+void commit_stop(void)
+{
+    mutex_lock(&commit_mutex);
+    commit_shutdown = 1;
+    condition_broadcast(&commit_queued);
+    mutex_unlock(&commit_mutex);
+    pthread_join(commit_thread, NULL);
+    free(commit_buffer);
+}
+
+// Function to append records to the write-ahead log with a single write, without waiting for the disk.
+// Returns what wal_sync waits for
+unsigned long wal_write(const char *records, size_t length)
+{
+    if (group_commit)
+        return commit_record(records, length);
+
+    // One write() per call on the shared O_APPEND descriptor, records never interleave
+    pthread_rwlock_rdlock(&wal_lock);
+    write_all(wal_fd, records, length);
+    pthread_rwlock_unlock(&wal_lock);
+    return 0;
+}
+
+// Function to wait until records appended by wal_write are on disk, with --group-commit or --sync
+void wal_sync(unsigned long lsn)
+{
+    if (group_commit)
+    {
+        // The virtual replay runs on a single thread and does not wait for the disk
+        if (!virtual_time)
+            commit_wait(lsn);
+    }
+    else if (sync_writes)
+    {
+        pthread_rwlock_rdlock(&wal_lock);
+        fdatasync(wal_fd);
+        pthread_rwlock_unlock(&wal_lock);
+    }
+}
+
+// Function to flush a stdio file to disk before it is renamed into place
+void sync_file(FILE *file)
+{
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+    {
+        perror("Error syncing file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to make the renames in the working directory durable
+void sync_directory(void)
+{
+    int fd = open(".", O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Function to write every table and its index from memory to disk. Each file is written to a temporary
+// file, synced and renamed over the old one, so a crash leaves either the old or the new file
+void checkpoint_tables(void)
+{
+    // Snapshot every table under its read lock into a temporary file, then rename it over the table
+    for (int i = 0; i < num_tables; i++)
+    {
+        char temp_filename[48];
+        snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", tables[i]);
+        FILE *table_file = fopen(temp_filename, "w");
+        if (!table_file)
+        {
+            perror("Error compacting table");
+            exit(EXIT_FAILURE);
+        }
+
+        int rows_written;
+        if (mvcc)
+        {
+            epoch_enter();
+            TableVersion *version = atomic_load(&table_versions[i]);
+            for (int row = 0; row < version->row_count; row++)
+                fprintf(table_file, "%s\n", version->rows[row]);
+            rows_written = version->row_count;
+            epoch_exit();
+        }
+        else
+        {
+            LockRequest request;
+            int shard = lock_table_for_snapshot(i, &request);
+            TableStore *store = &table_stores[i];
+            for (int row = 0; row < store->row_count; row++)
+                fprintf(table_file, "%s\n", store->rows[row]);
+            rows_written = store->row_count;
+            unlock_table_for_snapshot(i, &request, shard);
+        }
+
+        sync_file(table_file);
+        long bytes = ftell(table_file);
+        fclose(table_file);
+        rename(temp_filename, tables[i]);
+        table_file_swap(i, tables[i], rows_written, bytes);
+
+        // The key-value index goes to its own file as "<key> <value>" lines in key order
+        char index_filename[32];
+        snprintf(index_filename, sizeof(index_filename), "tbl%d.kv.txt", i + 1);
+        LockRequest request;
+        int shard = lock_table_for_snapshot(i, &request);
+        if (table_stores[i].key_count == 0)
+        {
+            unlock_table_for_snapshot(i, &request, shard);
+            unlink(index_filename);
+            continue;
+        }
+        snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", index_filename);
+        FILE *index_file = fopen(temp_filename, "w");
+        if (!index_file)
+        {
+            perror("Error compacting index");
+            exit(EXIT_FAILURE);
+        }
+        BTreeNode *leaf = table_stores[i].index;
+        while (!leaf->leaf)
+            leaf = leaf->children[0];
+        for (; leaf; leaf = leaf->next)
+        {
+            for (int k = 0; k < leaf->count; k++)
+                fprintf(index_file, "%d %s\n", leaf->keys[k], leaf->values[k]);
+        }
+        unlock_table_for_snapshot(i, &request, shard);
+        sync_file(index_file);
+        fclose(index_file);
+        rename(temp_filename, index_filename);
+    }
+    sync_directory();
+}
+
+// Function to checkpoint the tables and start a new write-ahead log
+void compact_tables(void)
+{
+    client_mutex_lock(&compaction_mutex);
+
+    // Swap in a new log; records still going to the old one are covered by the checkpoint below.
+    // A writer may not have synced its record yet, so the old log reaches the disk first
+    pthread_rwlock_wrlock(&wal_lock);
+    if (sync_writes)
+        fdatasync(wal_fd);
+    close(wal_fd);
+    rename(WAL_FILENAME, WAL_OLD_FILENAME);
+    wal_open();
+    pthread_rwlock_unlock(&wal_lock);
+
+    // The old log is only needed until every table file has reached the disk
+    checkpoint_tables();
+    unlink(WAL_OLD_FILENAME);
+
+    atomic_store(&writes_since_compaction, 0);
+    pthread_mutex_unlock(&compaction_mutex);
+}
+
+// Function to build the table of the CRC-32 used for log records
+void crc32_init(void)
+{
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        unsigned int crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        crc32_table[i] = crc;
+    }
+}
+
+// Function to compute the CRC-32 of a buffer
+unsigned int crc32_compute(const char *data, size_t length)
+{
+    unsigned int crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+        crc = crc32_table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Function to put the checksum in front of a record printed at buffer + WAL_CHECKSUM_WIDTH, if it fit.
+// Returns the length of the whole record
+int checksum_record(char *buffer, size_t size, int length)
+{
+    if (length <= 0)
+        return 0;
+    if (size > (size_t)(WAL_CHECKSUM_WIDTH + length))
+    {
+        char prefix[WAL_CHECKSUM_WIDTH + 1];
+        snprintf(prefix, sizeof(prefix), "%08x ", crc32_compute(buffer + WAL_CHECKSUM_WIDTH, length - 1));
+        memcpy(buffer, prefix, WAL_CHECKSUM_WIDTH);
+    }
+    return WAL_CHECKSUM_WIDTH + length;
+}
+
+// Function to format the log record of a write like snprintf. The records are "<table_id> <row> <value>"
+// for appended rows, "<table_id> put <key> <value>" and "<table_id> delete <key>", each after its checksum
+int format_write_record(char *buffer, size_t size, const Activity *activity, int row)
+{
+    char *record = size > WAL_CHECKSUM_WIDTH ? buffer + WAL_CHECKSUM_WIDTH : NULL;
+    size_t record_size = size > WAL_CHECKSUM_WIDTH ? size - WAL_CHECKSUM_WIDTH : 0;
+    int length;
+    switch (activity->operation_type)
+    {
+    case OP_WRITE:
+        length = snprintf(record, record_size, "%d %d %s\n", activity->table_id, row, activity->written_value);
+        break;
+    case OP_PUT:
+        length = snprintf(record, record_size, "%d put %d %s\n", activity->table_id, activity->key, activity->written_value);
+        break;
+    case OP_DELETE:
+        length = snprintf(record, record_size, "%d delete %d\n", activity->table_id, activity->key);
+        break;
+    default:
+        return 0;
+    }
+    return checksum_record(buffer, size, length);
+}
+
+// Function to format the record that starts a transaction's group of count records
+int format_txn_record(char *buffer, size_t size, int count)
+{
+    char *record = size > WAL_CHECKSUM_WIDTH ? buffer + WAL_CHECKSUM_WIDTH : NULL;
+    size_t record_size = size > WAL_CHECKSUM_WIDTH ? size - WAL_CHECKSUM_WIDTH : 0;
+    return checksum_record(buffer, size, snprintf(record, record_size, "txn %d\n", count));
+}
+
+// Function to count logged writes and compact the tables every --compact-every writes
+void count_writes(int writes)
+{
+    if (compact_every <= 0)
+        return;
+    int before = atomic_fetch_add(&writes_since_compaction, writes);
+    if (before < compact_every && before + writes >= compact_every)
+        compact_tables();
+}
+
+// Function to log a write. Called while the write still holds its table or key, so the log has the
+// writes to a row or key in the order they were applied. Returns what persist_sync waits for
+unsigned long persist_write(const Activity *activity, int row)
+{
+    char stack_record[256];
+    int length = format_write_record(stack_record, sizeof(stack_record), activity, row);
+    if (length <= 0)
+        return 0;
+    char *record = stack_record;
+    if ((size_t)length >= sizeof(stack_record))
+    {
+        record = malloc(length + 1);
+        format_write_record(record, length + 1, activity, row);
+    }
+    unsigned long lsn = wal_write(record, length);
+    if (record != stack_record)
+        free(record);
+    return lsn;
+}
+
+// Function to wait until logged writes are durable and compact the tables every --compact-every writes.
+// Called after the lock is released: neither the disk nor a compaction is waited for inside it
+void persist_sync(unsigned long lsn, int writes)
+{
+    wal_sync(lsn);
+    count_writes(writes);
+}
+
+// Function to read a whole file into a NUL-terminated buffer. Returns NULL if the file does not exist
+char *read_file(const char *filename, size_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    fstat(fd, &info);
+    char *data = malloc(info.st_size + 1);
+    if (!data)
+    {
+        perror("Error allocating file buffer");
+        exit(EXIT_FAILURE);
+    }
+    size_t total = 0;
+    while (total < (size_t)info.st_size)
+    {
+        ssize_t count = read(fd, data + total, info.st_size - total);
+        if (count <= 0)
+            break;
+        total += count;
+    }
+    close(fd);
+    data[total] = '\0';
+    *size = total;
+    return data;
+}
+
+// Function to load a table's rows from tbl<i>.txt and its keys from tbl<i>.kv.txt, as left by the last checkpoint
+void load_table(int table_id)
+{
+    size_t size = 0;
+    char *data = read_file(tables[table_id], &size);
+    if (!data)
+    {
+        create_file(tables[table_id]);
+    }
+    else
+    {
+        for (char *line = data; line < data + size;)
+        {
+            char *newline = strchr(line, '\n');
+            if (newline)
+                *newline = '\0';
+            store_append(table_id, line);
+            line = newline ? newline + 1 : data + size;
+        }
+        free(data);
+    }
+    table_file_swap(table_id, tables[table_id], table_stores[table_id].row_count, size);
+
+    char index_filename[32];
+    snprintf(index_filename, sizeof(index_filename), "tbl%d.kv.txt", table_id + 1);
+    data = read_file(index_filename, &size);
+    if (!data)
+        return;
+    for (char *line = data; line < data + size;)
+    {
+        char *newline = strchr(line, '\n');
+        if (newline)
+            *newline = '\0';
+        char *value;
+        int key = strtol(line, &value, 10);
+        if (*value == ' ')
+            index_put(table_id, key, value + 1);
+        line = newline ? newline + 1 : data + size;
+    }
+    free(data);
+}
+
+// Function to check the log record at data. Returns its length including the newline, or 0 if the
+// record is torn or its checksum does not match
+size_t wal_check_record(const char *data, size_t size)
+{
+    const char *newline = memchr(data, '\n', size);
+    if (!newline || newline - data < WAL_CHECKSUM_WIDTH || data[WAL_CHECKSUM_WIDTH - 1] != ' ')
+        return 0;
+    char hex[WAL_CHECKSUM_WIDTH];
+    memcpy(hex, data, WAL_CHECKSUM_WIDTH - 1);
+    hex[WAL_CHECKSUM_WIDTH - 1] = '\0';
+    char *end;
+    unsigned long expected = strtoul(hex, &end, 16);
+    if (end != hex + WAL_CHECKSUM_WIDTH - 1)
+        return 0;
+    const char *record = data + WAL_CHECKSUM_WIDTH;
+    if (crc32_compute(record, newline - record) != expected)
+        return 0;
+    return newline - data + 1;
+}
+
+// Function to put a recovered row at its logged row number. Writers to a table may log their rows out
+// of order, so the rows in between are left empty until their records come; a row that is already
+// there is kept, so replaying a log twice changes nothing
+void recover_row(int table_id, int row, const char *value)
+{
+    TableStore *store = &table_stores[table_id];
+    if (row < 0)
+        return;
+    if (row >= store->row_capacity)
+    {
+        while (row >= store->row_capacity)
+            store->row_capacity = store->row_capacity ? store->row_capacity * 2 : 16;
+        store->rows = realloc(store->rows, store->row_capacity * sizeof(char *));
+        if (!store->rows)
+        {
+            perror("Error allocating rows");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (store->row_count <= row)
+        store->rows[store->row_count++] = NULL;
+    if (!store->rows[row])
+        store->rows[row] = strdup(value);
+}
+
+// Function to close the gaps of rows whose records never made it to the log, then hand the rows to
+// the first committed version with --mvcc. Returns the number of gaps
+int recover_finish(int table_id)
+{
+    TableStore *store = &table_stores[table_id];
+    int kept = 0;
+    for (int row = 0; row < store->row_count; row++)
+    {
+        if (store->rows[row])
+            store->rows[kept++] = store->rows[row];
+    }
+    int gaps = store->row_count - kept;
+    store->row_count = kept;
+
+    if (mvcc)
+    {
+        TableVersion *version = atomic_load(&table_versions[table_id]);
+        version->rows = store->rows;
+        version->row_count = store->row_count;
+        version->row_capacity = store->row_capacity;
+        store->rows = NULL;
+        store->row_count = 0;
+        store->row_capacity = 0;
+    }
+    return gaps;
+}
+
+// Function to apply a checked log record. Appended rows carry their row number, so a row that is
+// already in the table file is not appended again and the rows end up in row order, however they were logged
+void recover_record(char *record)
+{
+    char *cursor;
+    int table_id = strtol(record, &cursor, 10) - 1;
+    if (table_id < 0 || table_id >= num_tables || *cursor != ' ')
+        return;
+    cursor++;
+
+    if (strncmp(cursor, "put ", 4) == 0)
+    {
+        int key = strtol(cursor + 4, &cursor, 10);
+        if (*cursor == ' ')
+            index_put(table_id, key, cursor + 1);
+    }
+    else if (strncmp(cursor, "delete ", 7) == 0)
+    {
+        index_delete(table_id, strtol(cursor + 7, NULL, 10));
+    }
+    else
+    {
+        int row = strtol(cursor, &cursor, 10);
+        if (*cursor == ' ')
+            recover_row(table_id, row, cursor + 1);
+    }
+}
+
+// Function to replay the records of a log file. Returns 0 if it stopped at a torn or corrupt record,
+// after counting the bytes from there on as dropped
+int replay_log(const char *filename, long *replayed, long *dropped)
+{
+    size_t size;
+    char *data = read_file(filename, &size);
+    if (!data)
+        return 1;
+
+    size_t position = 0;
+    while (position < size)
+    {
+        size_t length = wal_check_record(data + position, size - position);
+        if (length == 0)
+            break;
+        char *record = data + position + WAL_CHECKSUM_WIDTH;
+        data[position + length - 1] = '\0';
+
+        // A transaction's records are applied only if the whole group is there
+        int count = 1;
+        size_t group_length = length;
+        if (strncmp(record, "txn ", 4) == 0)
+        {
+            count = atoi(record + 4);
+            for (int i = 0; i < count && group_length; i++)
+            {
+                size_t member = wal_check_record(data + position + group_length, size - position - group_length);
+                group_length = member ? group_length + member : 0;
+            }
+            if (group_length == 0)
+                break;
+            record += length;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            char *newline = strchr(record, '\n');
+            if (newline)
+                *newline = '\0';
+            recover_record(record);
+            if (newline)
+                record = newline + 1 + WAL_CHECKSUM_WIDTH;
+        }
+        *replayed += count;
+        position += group_length;
+    }
+
+    *dropped += size - position;
+    free(data);
+    return position == size;
+}
+
+// Function to rebuild the tables from the last checkpoint and the log written since. A log left by a
+// crashed compaction is replayed first; the result is checkpointed before the log is started again
+void recover_tables(void)
+{
+    long long start = monotonic_ns();
+    for (int i = 0; i < num_tables; i++)
+        load_table(i);
+
+    // Nothing after a damaged record can be trusted, it may depend on the lost one
+    long replayed = 0, dropped = 0;
+    if (replay_log(WAL_OLD_FILENAME, &replayed, &dropped))
+        replay_log(WAL_FILENAME, &replayed, &dropped);
+    else
+    {
+        struct stat info;
+        if (stat(WAL_FILENAME, &info) == 0)
+            dropped += info.st_size;
+    }
+    int gaps = 0;
+    for (int i = 0; i < num_tables; i++)
+        gaps += recover_finish(i);
+
+    if (replayed > 0 || dropped > 0)
+    {
+        checkpoint_tables();
+        printf("Recovered %ld log records in %.1f ms, dropped %ld bytes of torn log\n", replayed,
+               (monotonic_ns() - start) / 1e6, dropped);
+    }
+    if (gaps > 0)
+        printf("Recovery skipped %d rows whose log records were lost\n", gaps);
+    unlink(WAL_OLD_FILENAME);
+}
+
+// Function to log an event: a few stores into the calling thread's ring, no lock and no system call
+void log_event(LogEventType type, int thread_id, int table_id)
+{
+    LogRing *ring = &log_rings[log_slot];
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    // A full ring waits for the log writer instead of dropping the event. The whole OS thread
+    // yields: with --workers every client of the worker shares the ring and would find it full too
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SIZE)
+        sched_yield();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LogEvent *event = &ring->events[tail & (LOG_RING_SIZE - 1)];
+    event->sequence = atomic_fetch_add_explicit(&log_sequence, 1, memory_order_relaxed);
+    event->timestamp_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    event->thread_id = thread_id;
+    event->table_id = table_id;
+    event->type = type;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// Function to write one event to the log file, as text or as a binary record
+void log_write(const LogEvent *event)
+{
+    if (log_binary)
+    {
+        fwrite(event, sizeof(LogEvent), 1, log_file);
+        return;
+    }
+
+    const char *table = tables[event->table_id];
+    switch (event->type)
+    {
+    case LOG_READ_START:
+        fprintf(log_file, "Reader %d started reading %s\n", event->thread_id, table);
+        break;
+    case LOG_READ_END:
+        fprintf(log_file, "Reader %d finished reading %s\n", event->thread_id, table);
+        break;
+    case LOG_WRITE_WAIT:
+        fprintf(log_file, "Writer %d waiting to write to %s\n", event->thread_id, table);
+        break;
+    case LOG_WRITE_START:
+        fprintf(log_file, "Writer %d started writing to %s\n", event->thread_id, table);
+        break;
+    case LOG_WRITE_END:
+        fprintf(log_file, "Writer %d finished writing to %s\n", event->thread_id, table);
+        break;
+    }
+}
+
+// Compare function for sorting log events by sequence number
+int compare_log_events(const void *a, const void *b)
+{
+    unsigned long sequence1 = ((const LogEvent *)a)->sequence;
+    unsigned long sequence2 = ((const LogEvent *)b)->sequence;
+    return sequence1 < sequence2 ? -1 : sequence1 > sequence2;
+}
+
+// Log writer thread: collects the events of all rings and writes them in sequence order
+void *log_writer(void *arg)
+{
+    (void)arg;
+    LogEvent *pending = NULL; // Collected events that are not written yet
+    int pending_count = 0;
+    int pending_capacity = 0;
+    unsigned long next_sequence = 0;
+
+    while (1)
+    {
+        // Read the shutdown flag first, so an empty pass after it really means nothing is left
+        int stopping = atomic_load(&log_shutdown);
+
+        // Empty every ring into the pending events
+        int collected = 0;
+        for (int i = 0; i < num_log_rings; i++)
+        {
+            LogRing *ring = &log_rings[i];
+            size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            for (; head != tail; head++)
+            {
+                if (pending_count == pending_capacity)
+                {
+                    pending_capacity = pending_capacity ? pending_capacity * 2 : 1024;
+                    pending = realloc(pending, pending_capacity * sizeof(LogEvent));
+                    if (!pending)
+                    {
+                        perror("Error allocating log events");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                pending[pending_count++] = ring->events[head & (LOG_RING_SIZE - 1)];
+                collected++;
+            }
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+        }
+
+        // Write the events without a gap; a gap is an event whose thread has not pushed it yet.
+        // Until the first event arrives there is no buffer to sort
+        if (pending_count > 0)
+        {
+            qsort(pending, pending_count, sizeof(LogEvent), compare_log_events);
+            int written = 0;
+            while (written < pending_count && pending[written].sequence == next_sequence)
+            {
+                log_write(&pending[written++]);
+                next_sequence++;
+            }
+            memmove(pending, pending + written, (pending_count - written) * sizeof(LogEvent));
+            pending_count -= written;
+        }
+
+        if (collected == 0)
+        {
+            if (stopping && pending_count == 0)
+                break;
+
+            // Idle: make the log visible and wait for more events
+            fflush(log_file);
+            struct timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    fflush(log_file);
+    free(pending);
+    return NULL;
+}
+
+// Function to start the log writer
+void log_start(int num_threads)
+{
+    num_log_rings = num_threads + 1;
+    log_rings = aligned_alloc(CACHE_LINE_SIZE, num_log_rings * sizeof(LogRing));
+    if (!log_rings)
+    {
+        perror("Error allocating log rings");
+        exit(EXIT_FAILURE);
+    }
+    memset(log_rings, 0, num_log_rings * sizeof(LogRing));
+    pthread_create(&log_thread, NULL, log_writer, NULL);
+}
+
+// Function to write out the remaining events and stop the log writer
+void log_stop(void)
+{
+    atomic_store(&log_shutdown, 1);
+    pthread_join(log_thread, NULL);
+    free(log_rings);
+}
+
+// Lock profiler, enabled with --profile: wait and hold times, queue depth and handoffs per table
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS (61 * HISTOGRAM_SUB_BUCKETS)
+
+// Log-linear histogram of nanosecond values in the style of HdrHistogram: 16 linear sub-buckets per
+// power of two, so every value is recorded to within about 6%
+typedef struct
+{
+    atomic_long counts[HISTOGRAM_BUCKETS];
+    atomic_long count;
+    atomic_long total;
+    atomic_long max;
+} Histogram;
+
+// Lock statistics of a table
+typedef struct
+{
+    Histogram read_wait;
+    Histogram write_wait;
+    Histogram read_hold;
+    Histogram write_hold;
+    atomic_int waiting;         // Threads waiting for the table right now
+    atomic_int max_waiting;
+    atomic_int last_holder;     // 0 before the first acquisition, 1 after a reader, 2 after a writer
+    atomic_long reader_to_writer;
+    atomic_long writer_to_reader;
+    atomic_long starved;        // Waits longer than --starvation-ms
+} TableProfile;
+
+// Lock statistics of a thread, only updated by the thread itself
+typedef struct
+{
+    long operations;
+    long long wait_ns;
+    long long max_wait_ns;
+} ThreadProfile;
+
+const char *profile_filename = NULL;
+long profile_interval_ms = 0;
+long long starvation_ns = 1000000000LL;
+TableProfile *table_profiles;
+ThreadProfile *thread_profiles;
+Histogram operation_latency; // Whole activities, from arrival to the end, across all tables
+int num_thread_profiles;
+long long profile_start_ns;
+
+// Periodic samples: elapsed time, finished acquisitions, then the waiting threads of every table
+long long *profile_samples;
+int profile_sample_count = 0;
+int profile_sample_capacity = 0;
+atomic_int profile_sampler_stop;
+pthread_t profile_sampler_thread;
+
+// Function to read the profiler clock in nanoseconds: monotonic time, or virtual time in a replay
+long long profile_now(void)
+{
+    if (virtual_time)
+        return sim_now;
+    return monotonic_ns();
+}
+
+// Function to find the histogram bucket of a value
+int histogram_bucket(long long value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value < 0 ? 0 : value;
+    int exponent = 63 - __builtin_clzll(value);
+    int sub_bucket = (value >> (exponent - 4)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - 3) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+// Function to get the highest value that falls into a histogram bucket
+long long histogram_bucket_value(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + 3;
+    long long sub_bucket = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << (exponent - 4)) - 1;
+}
+
+// Function to record a value in a histogram
+void histogram_record(Histogram *histogram, long long value)
+{
+    atomic_fetch_add_explicit(&histogram->counts[histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, value, memory_order_relaxed);
+    long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak(&histogram->max, &max, value))
+        ;
+}
+
+// Function to get the value below which the given fraction of the recorded values lie
+long long histogram_percentile(Histogram *histogram, double fraction)
+{
+    long count = atomic_load(&histogram->count);
+    long rank = (long)(fraction * count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    long seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += atomic_load(&histogram->counts[bucket]);
+        if (seen >= rank)
+        {
+            long long value = histogram_bucket_value(bucket);
+            long max = atomic_load(&histogram->max);
+            return value < max ? value : max;
+        }
+    }
+    return atomic_load(&histogram->max);
+}
+
+// Function to note that a thread starts waiting for a table. Returns the start of the wait
+long long profile_wait_begin(int table_id)
+{
+    if (!profile_filename)
+        return 0;
+    TableProfile *profile = &table_profiles[table_id];
+    int waiting = atomic_fetch_add(&profile->waiting, 1) + 1;
+    int max_waiting = atomic_load(&profile->max_waiting);
+    while (waiting > max_waiting && !atomic_compare_exchange_weak(&profile->max_waiting, &max_waiting, waiting))
+        ;
+    return profile_now();
+}
+
+// Function to note that a thread gave up waiting for a table without getting it
+void profile_wait_abandoned(int table_id)
+{
+    if (profile_filename)
+        atomic_fetch_sub(&table_profiles[table_id].waiting, 1);
+}
+
+// Function to record the wait of a thread that got a table. Returns the start of the hold
+long long profile_acquired(int thread_id, int table_id, int writer, long long wait_start)
+{
+    if (!profile_filename)
+        return 0;
+    TableProfile *profile = &table_profiles[table_id];
+    long long now = profile_now();
+    long long wait = now - wait_start;
+    atomic_fetch_sub(&profile->waiting, 1);
+    histogram_record(writer ? &profile->write_wait : &profile->read_wait, wait);
+    if (wait > starvation_ns)
+        atomic_fetch_add(&profile->starved, 1);
+
+    // A handoff is the table going from readers to a writer or the other way round
+    int previous = atomic_exchange(&profile->last_holder, writer ? 2 : 1);
+    if (previous == 1 && writer)
+        atomic_fetch_add(&profile->reader_to_writer, 1);
+    else if (previous == 2 && !writer)
+        atomic_fetch_add(&profile->writer_to_reader, 1);
+
+    ThreadProfile *thread = &thread_profiles[thread_id];
+    thread->operations++;
+    thread->wait_ns += wait;
+    if (wait > thread->max_wait_ns)
+        thread->max_wait_ns = wait;
+    return now;
+}
+
+// Function to note the start of an activity. Returns the start time, 0 when not profiling
+long long profile_operation_begin(void)
+{
+    return profile_filename ? profile_now() : 0;
+}
+
+// Function to record the latency of a whole activity
+void profile_operation_end(long long start)
+{
+    if (profile_filename)
+        histogram_record(&operation_latency, profile_now() - start);
+}
+
+// Function to record how long a thread held a table
+void profile_released(int table_id, int writer, long long hold_start)
+{
+    if (!profile_filename)
+        return;
+    TableProfile *profile = &table_profiles[table_id];
+    histogram_record(writer ? &profile->write_hold : &profile->read_hold, profile_now() - hold_start);
+}
+
+// Sampler thread: records the queue depth of every table every --profile-interval milliseconds
+void *profile_sampler(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&profile_sampler_stop))
+    {
+        struct timespec pause = {profile_interval_ms / 1000, (profile_interval_ms % 1000) * 1000000};
+        nanosleep(&pause, NULL);
+
+        if (profile_sample_count + 2 + num_tables > profile_sample_capacity)
+        {
+            profile_sample_capacity = profile_sample_capacity ? profile_sample_capacity * 2 : 1024;
+            while (profile_sample_count + 2 + num_tables > profile_sample_capacity)
+                profile_sample_capacity *= 2;
+            profile_samples = realloc(profile_samples, profile_sample_capacity * sizeof(long long));
+            if (!profile_samples)
+            {
+                perror("Error allocating profile samples");
+                exit(EXIT_FAILURE);
+            }
+        }
+        long long *sample = &profile_samples[profile_sample_count];
+        sample[0] = (profile_now() - profile_start_ns) / 1000000;
+        sample[1] = 0;
+        for (int i = 0; i < num_tables; i++)
+        {
+            sample[1] += atomic_load(&table_profiles[i].read_wait.count) + atomic_load(&table_profiles[i].write_wait.count);
+            sample[2 + i] = atomic_load(&table_profiles[i].waiting);
+        }
+        profile_sample_count += 2 + num_tables;
+    }
+    return NULL;
+}
+
+// Function to start the profiler
+void profile_start(int num_threads)
+{
+    if (!profile_filename)
+        return;
+    table_profiles = calloc(num_tables, sizeof(TableProfile));
+    num_thread_profiles = num_threads + 1;
+    thread_profiles = calloc(num_thread_profiles, sizeof(ThreadProfile));
+    if (!table_profiles || !thread_profiles)
+    {
+        perror("Error allocating profiler");
+        exit(EXIT_FAILURE);
+    }
+    profile_start_ns = profile_now();
+
+    // Samples are taken in wall-clock time, which means nothing in a virtual replay
+    if (profile_interval_ms > 0 && !virtual_time)
+        pthread_create(&profile_sampler_thread, NULL, profile_sampler, NULL);
+}
+
+// Function to write a histogram as a JSON object
+void profile_write_histogram(FILE *file, const char *indent, const char *name, Histogram *histogram)
+{
+    long count = atomic_load(&histogram->count);
+    fprintf(file, "%s\"%s\": {\"count\": %ld, \"mean\": %ld, \"p50\": %lld, \"p90\": %lld, "
+                  "\"p99\": %lld, \"p999\": %lld, \"max\": %ld}",
+            indent, name, count, count ? atomic_load(&histogram->total) / count : 0,
+            count ? histogram_percentile(histogram, 0.5) : 0, count ? histogram_percentile(histogram, 0.9) : 0,
+            count ? histogram_percentile(histogram, 0.99) : 0, count ? histogram_percentile(histogram, 0.999) : 0,
+            atomic_load(&histogram->max));
+}
+
+// Function to stop the profiler and write everything it recorded to the --profile file as JSON
+void profile_stop(void)
+{
+    if (!profile_filename)
+        return;
+    if (profile_interval_ms > 0 && !virtual_time)
+    {
+        atomic_store(&profile_sampler_stop, 1);
+        pthread_join(profile_sampler_thread, NULL);
+    }
+
+    FILE *file = fopen(profile_filename, "w");
+    if (!file)
+    {
+        perror("Error opening profile file");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "{\n  \"time_unit\": \"ns\",\n  \"starvation_threshold\": %lld,\n", starvation_ns);
+    fprintf(file, "  \"elapsed\": %lld,\n", profile_now() - profile_start_ns);
+    profile_write_histogram(file, "  ", "latency", &operation_latency);
+    fprintf(file, ",\n  \"tables\": [\n");
+    for (int i = 0; i < num_tables; i++)
+    {
+        TableProfile *profile = &table_profiles[i];
+        fprintf(file, "    {\n      \"table\": \"%s\",\n", tables[i]);
+        profile_write_histogram(file, "      ", "read_wait", &profile->read_wait);
+        fprintf(file, ",\n");
+        profile_write_histogram(file, "      ", "write_wait", &profile->write_wait);
+        fprintf(file, ",\n");
+        profile_write_histogram(file, "      ", "read_hold", &profile->read_hold);
+        fprintf(file, ",\n");
+        profile_write_histogram(file, "      ", "write_hold", &profile->write_hold);
+        fprintf(file, ",\n      \"max_queue_depth\": %d,\n", atomic_load(&profile->max_waiting));
+        fprintf(file, "      \"handoffs\": {\"reader_to_writer\": %ld, \"writer_to_reader\": %ld},\n",
+                atomic_load(&profile->reader_to_writer), atomic_load(&profile->writer_to_reader));
+        fprintf(file, "      \"starved\": %ld\n    }%s\n", atomic_load(&profile->starved), i + 1 < num_tables ? "," : "");
+    }
+
+    fprintf(file, "  ],\n  \"threads\": [\n");
+    int first = 1;
+    for (int i = 0; i < num_thread_profiles; i++)
+    {
+        ThreadProfile *thread = &thread_profiles[i];
+        if (thread->operations == 0)
+            continue;
+        fprintf(file, "%s    {\"thread\": %d, \"operations\": %ld, \"wait\": %lld, \"max_wait\": %lld}",
+                first ? "" : ",\n", i, thread->operations, thread->wait_ns, thread->max_wait_ns);
+        first = 0;
+    }
+
+    fprintf(file, "\n  ],\n  \"samples\": [\n");
+    for (int k = 0; k < profile_sample_count; k += 2 + num_tables)
+    {
+        fprintf(file, "%s    {\"time_ms\": %lld, \"acquisitions\": %lld, \"queue_depth\": [",
+                k ? ",\n" : "", profile_samples[k], profile_samples[k + 1]);
+        for (int i = 0; i < num_tables; i++)
+            fprintf(file, "%s%lld", i ? ", " : "", profile_samples[k + 2 + i]);
+        fprintf(file, "]}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+
+    free(profile_samples);
+    free(table_profiles);
+    free(thread_profiles);
+}
+
+// Function to convert a trace time to wall-clock nanoseconds under --speed
+long long replay_scale(long long nanoseconds)
+{
+    return replay_speed == 1.0 ? nanoseconds : (long long)(nanoseconds / replay_speed);
+}
+
+// Function to note how far the calling thread runs behind its schedule
+void replay_measure_lateness(ReplayTimeline *timeline)
+{
+    long long lateness = monotonic_ns() - timeline->planned;
+    timeline->lateness = lateness > 0 ? lateness : 0;
+}
+
+// Function to wait out the gap before a thread's next activity, counted from where its schedule stands
+// rather than from now. A zero gap returns at once instead of still entering the kernel
+void replay_wait(long long gap)
+{
+    ReplayTimeline *timeline = &replay_timelines[thread_slot];
+    timeline->planned += replay_scale(gap);
+    if (gap > 0)
+        client_sleep_until_ns(timeline->planned);
+    replay_measure_lateness(timeline);
+}
+
+// Function to spend an activity's duration once it has its table. Time spent waiting for the table
+// pushes the schedule back; the lateness the thread already had when it woke up does not
+void replay_hold(long long duration)
+{
+    ReplayTimeline *timeline = &replay_timelines[thread_slot];
+    timeline->planned = monotonic_ns() - timeline->lateness + replay_scale(duration);
+    if (duration > 0)
+    {
+        client_sleep_until_ns(timeline->planned);
+        replay_measure_lateness(timeline);
+    }
+}
+
+// Function to perform a read on a snapshot, without waiting for writers and without holding them up
+void perform_snapshot_read(int thread_id, int table_id, long long duration)
+{
+    // Take the latest committed version; it stays valid until the epoch is left
+    long long wait_start = profile_wait_begin(table_id);
+    epoch_enter();
+    TableVersion *snapshot = atomic_load(&table_versions[table_id]);
+    long long hold_start = profile_acquired(thread_id, table_id, 0, wait_start);
+
+    log_event(LOG_READ_START, thread_id, table_id);
+
+    // Wait for duration
+    replay_hold(duration);
+
+    // Read the rows of the snapshot
+    char **rows;
+    reply_count = read_snapshot(snapshot, &rows);
+
+    log_event(LOG_READ_END, thread_id, table_id);
+
+    epoch_exit();
+    profile_released(table_id, 0, hold_start);
+}
+
+// Function to perform read operation
+void perform_read(int thread_id, const Activity *activity)
+{
+    int table_id = activity->table_id - 1;
+
+    // Wait until the lock policy lets this reader in
+    long long wait_start = profile_wait_begin(table_id);
+    int shard = acquire_read(&table_locks[table_id]);
+    long long hold_start = profile_acquired(thread_id, table_id, 0, wait_start);
+
+    // Reading operation
+    log_event(LOG_READ_START, thread_id, table_id);
+
+    // Wait for duration
+    replay_hold(activity->duration);
+
+    // Read the rows or keys of the table
+    apply_read(activity);
+
+    // Log the end of reading
+    log_event(LOG_READ_END, thread_id, table_id);
+
+    // Leave the table, waking a waiting writer if this was the last reader
+    release_read(&table_locks[table_id], shard);
+    profile_released(table_id, 0, hold_start);
+}
+
+
+// Function to perform write operation
+void perform_write(int thread_id, const Activity *activity)
+{
+    int table_id = activity->table_id - 1;
+    log_event(LOG_WRITE_WAIT, thread_id, table_id);
+
+    // Wait for write lock
+    long long wait_start = profile_wait_begin(table_id);
+    acquire_write(&table_locks[table_id]);
+    long long hold_start = profile_acquired(thread_id, table_id, 1, wait_start);
+
+    // Writing operation
+    log_event(LOG_WRITE_START, thread_id, table_id);
+
+    // Wait for duration
+    replay_hold(activity->duration);
+
+    // Change the in-memory table and append the change to the log in the same order
+    int row = apply_write_latched(activity);
+    unsigned long lsn = persist_write(activity, row);
+
+    // Log the end of writing
+    log_event(LOG_WRITE_END, thread_id, table_id);
+
+    // Release write lock
+    release_write(&table_locks[table_id]);
+    profile_released(table_id, 1, hold_start);
+
+    // Wait for the disk outside of the critical section
+    persist_sync(lsn, 1);
+}
+
+// Function to perform an activity under the lock manager, so operations on disjoint keys of a table overlap
+void perform_with_lock_manager(int thread_id, const Activity *activity)
+{
+    int table_id = activity->table_id - 1;
+    int writer = is_write_operation(activity->operation_type);
+    TableLockManager *manager = &lock_managers[table_id];
+    LockRequest request;
+    lock_request_init(&request, activity, atomic_fetch_add(&lock_clock, 1) + 1);
+
+    if (writer)
+        log_event(LOG_WRITE_WAIT, thread_id, table_id);
+
+    // A request that dies retries with its old timestamp, so it only gets older until it wins
+    long long wait_start = profile_wait_begin(table_id);
+    while (!lock_manager_acquire(manager, &request))
+    {
+        client_sleep_ns(1000000);
+    }
+    long long hold_start = profile_acquired(thread_id, table_id, writer, wait_start);
+    log_event(writer ? LOG_WRITE_START : LOG_READ_START, thread_id, table_id);
+
+    // Wait for duration
+    replay_hold(activity->duration);
+
+    // Key operations share the index and latch it only for the lookup or change itself;
+    // a whole-table read already keeps every writer out
+    unsigned long lsn = 0;
+    if (writer)
+        lsn = persist_write(activity, apply_write_latched(activity));
+    else if (request.key_mode == LOCK_NONE)
+        apply_read(activity);
+    else
+        apply_read_latched(activity);
+
+    log_event(writer ? LOG_WRITE_END : LOG_READ_END, thread_id, table_id);
+    lock_manager_release(manager, &request);
+    profile_released(table_id, writer, hold_start);
+
+    // Wait for the disk outside of the critical section
+    if (writer)
+        persist_sync(lsn, 1);
+}
+
+// Function to apply a request on the owner of its table, then wake the client that sent it
+void owner_apply(OwnerRequest *request)
+{
+    const Activity *activity = request->activity;
+    int thread_id = request->thread_id;
+    int table_id = activity->table_id - 1;
+    Client *client = request->client;
+
+    if (is_write_operation(activity->operation_type))
+    {
+        log_event(LOG_WRITE_WAIT, thread_id, table_id);
+        log_event(LOG_WRITE_START, thread_id, table_id);
+        request->lsn = persist_write(activity, apply_write(activity));
+        log_event(LOG_WRITE_END, thread_id, table_id);
+    }
+    else
+    {
+        log_event(LOG_READ_START, thread_id, table_id);
+        if (mvcc && activity->operation_type == OP_READ)
+        {
+            char **rows;
+            read_snapshot(atomic_load(&table_versions[table_id]), &rows);
+        }
+        else
+        {
+            apply_read(activity);
+        }
+        log_event(LOG_READ_END, thread_id, table_id);
+    }
+
+    // The request may be gone as soon as a thread sees done, so the client was read before
+    if (client)
+    {
+        client_make_ready(client);
+    }
+    else
+    {
+        atomic_store(&request->done, 1);
+        futex_wake(&request->done, 1);
+    }
+}
+
+// Function to check whether an owner has anything to do
+int owner_has_work(TableOwner *owner)
+{
+    if (atomic_load(&owner->pause) || atomic_load(&owner->stop))
+        return 1;
+    for (int i = 0; i < num_request_rings; i++)
+    {
+        if (atomic_load(&owner->rings[i].tail) != atomic_load_explicit(&owner->rings[i].head, memory_order_relaxed))
+            return 1;
+    }
+    return 0;
+}
+
+// Owner thread: applies the requests of all its rings, spinning a while and then sleeping when idle
+void *owner_function(void *arg)
+{
+    TableOwner *owner = arg;
+    log_slot = num_request_rings + (owner - owners);
+    thread_slot = num_epoch_slots - num_owners + (owner - owners);
+    int idle = 0;
+
+    while (1)
+    {
+        int doorbell = atomic_load(&owner->doorbell);
+        int served = 0;
+        for (int i = 0; i < num_request_rings; i++)
+        {
+            RequestRing *ring = &owner->rings[i];
+            size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            for (; head != tail; head++, served++)
+                owner_apply(ring->requests[head & (REQUEST_RING_SIZE - 1)]);
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+        }
+
+        // Compaction: wait between two requests until the tables were written out
+        if (atomic_load(&owner->pause))
+        {
+            atomic_store(&owner->paused, 1);
+            futex_wake(&owner->paused, 1);
+            while (atomic_load(&owner->pause))
+                futex_wait(&owner->pause, 1, NULL);
+            atomic_store(&owner->paused, 0);
+            continue;
+        }
+        if (served > 0)
+        {
+            idle = 0;
+            continue;
+        }
+        if (atomic_load(&owner->stop))
+            break;
+        if (++idle < mutex_max_spins)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        // A producer either sees the flag and rings, or its request is seen by the check below
+        atomic_store(&owner->sleeping, 1);
+        if (!owner_has_work(owner))
+            futex_wait(&owner->doorbell, doorbell, NULL);
+        atomic_store(&owner->sleeping, 0);
+        idle = 0;
+    }
+    return NULL;
+}
+
+// Function to start the owner threads; producers are the OS threads with log slots below num_producers
+void owners_start(int num_producers)
+{
+    num_request_rings = num_producers;
+    owners = aligned_alloc(CACHE_LINE_SIZE, num_owners * sizeof(TableOwner));
+    if (!owners)
+    {
+        perror("Error allocating table owners");
+        exit(EXIT_FAILURE);
+    }
+    memset(owners, 0, num_owners * sizeof(TableOwner));
+    for (int i = 0; i < num_owners; i++)
+    {
+        owners[i].rings = aligned_alloc(CACHE_LINE_SIZE, num_request_rings * sizeof(RequestRing));
+        if (!owners[i].rings)
+        {
+            perror("Error allocating request rings");
+            exit(EXIT_FAILURE);
+        }
+        memset(owners[i].rings, 0, num_request_rings * sizeof(RequestRing));
+        pthread_create(&owners[i].thread, NULL, owner_function, &owners[i]);
+    }
+}
+
+// Function to stop the owner threads once no more requests can come
+void owners_stop(void)
+{
+    for (int i = 0; i < num_owners; i++)
+    {
+        atomic_store(&owners[i].stop, 1);
+        owner_notify(&owners[i]);
+        pthread_join(owners[i].thread, NULL);
+        free(owners[i].rings);
+    }
+    free(owners);
+    owners = NULL;
+}
+
+// Function to send an operation to the owner of its table and wait for it. The client spends the
+// duration itself, the owner applies the operation in one step
+void perform_on_owner(int thread_id, const Activity *activity)
+{
+    replay_hold(activity->duration);
+
+    OwnerRequest request = {activity, thread_id, 0, current_client, 0};
+    TableOwner *owner = table_owner(activity->table_id - 1);
+    RequestRing *ring = &owner->rings[log_slot];
+
+    // A full ring waits for the owner; the clients of a worker share the ring, so the whole thread yields
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == REQUEST_RING_SIZE)
+        sched_yield();
+    ring->requests[tail & (REQUEST_RING_SIZE - 1)] = &request;
+    atomic_store(&ring->tail, tail + 1);
+    owner_notify(owner);
+
+    // A client is woken exactly once by the owner; an OS thread sleeps on the done flag
+    if (request.client)
+    {
+        client_park();
+    }
+    else
+    {
+        while (!atomic_load(&request.done))
+            futex_wait(&request.done, 0, NULL);
+    }
+
+    if (is_write_operation(activity->operation_type))
+        persist_sync(request.lsn, 1);
+}
+
+// Transactions: the operations between begin and commit of a thread run as one atomic unit
+typedef enum
+{
+    TXN_OCC, // Optimistic: lock-free reads, then lock the writes, validate the reads and apply (default)
+    TXN_2PL  // Two-phase locking: every lock before the first operation, all released at commit
+} TxnMode;
+
+TxnMode txn_mode = TXN_OCC;
+atomic_long txn_commits;
+atomic_long txn_aborts;
+
+// Operation of a running transaction
+typedef struct
+{
+    const Activity *activity;
+    unsigned long observed; // OCC: version the read saw
+    int row;                // Row of an appended value
+    int locked;             // The entry holds the lock below, or the table lock of its table
+    int shard;              // Table granularity: reader shard of the table lock
+    long long hold_start;   // Profiler: when the lock was taken
+    LockRequest request;    // Key granularity: locks of the operation
+} TxnEntry;
+
+// Compare function for the lock order of a transaction: by table, writes first, then by key
+int compare_txn_entries(const void *a, const void *b)
+{
+    const Activity *activity1 = (*(TxnEntry *const *)a)->activity;
+    const Activity *activity2 = (*(TxnEntry *const *)b)->activity;
+    if (activity1->table_id != activity2->table_id)
+        return activity1->table_id - activity2->table_id;
+    int writer1 = is_write_operation(activity1->operation_type);
+    int writer2 = is_write_operation(activity2->operation_type);
+    if (writer1 != writer2)
+        return writer2 - writer1;
+    return (activity1->key > activity2->key) - (activity1->key < activity2->key);
+}
+
+// Function to release the locks a transaction took
+void txn_unlock(TxnEntry **order, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        TxnEntry *entry = order[i];
+        if (!entry->locked)
+            continue;
+        int table_id = entry->activity->table_id - 1;
+        int writer = is_write_operation(entry->activity->operation_type);
+        if (lock_granularity == GRANULARITY_KEY)
+            lock_manager_release(&lock_managers[table_id], &entry->request);
+        else if (writer)
+            release_write(&table_locks[table_id]);
+        else
+            release_read(&table_locks[table_id], entry->shard);
+        profile_released(table_id, writer, entry->hold_start);
+        entry->locked = 0;
+    }
+}
+
+// Function to take the locks of a transaction in lock order, only those of its writes if only_writes
+// is set. Table locks are taken once per table, for writing if the transaction writes it. Returns 0
+// with nothing held if an older transaction holds a conflicting key lock (wait-die)
+int txn_lock(int thread_id, TxnEntry **order, int count, int only_writes, unsigned long timestamp)
+{
+    for (int i = 0; i < count; i++)
+    {
+        TxnEntry *entry = order[i];
+        int table_id = entry->activity->table_id - 1;
+        int writer = is_write_operation(entry->activity->operation_type);
+        entry->locked = 0;
+        if (only_writes && !writer)
+            continue;
+
+        // Writes sort first, so the first entry of a table decides the mode of its table lock
+        if (lock_granularity == GRANULARITY_TABLE && i > 0 && order[i - 1]->activity->table_id == entry->activity->table_id)
+            continue;
+
+        long long wait_start = profile_wait_begin(table_id);
+        if (lock_granularity == GRANULARITY_KEY)
+        {
+            lock_request_init(&entry->request, entry->activity, timestamp);
+            if (!lock_manager_acquire(&lock_managers[table_id], &entry->request))
+            {
+                profile_wait_abandoned(table_id);
+                txn_unlock(order, i);
+                return 0;
+            }
+        }
+        else if (writer)
+        {
+            acquire_write(&table_locks[table_id]);
+        }
+        else
+        {
+            entry->shard = acquire_read(&table_locks[table_id]);
+        }
+        entry->hold_start = profile_acquired(thread_id, table_id, writer, wait_start);
+        entry->locked = 1;
+    }
+    return 1;
+}
+
+// Function to read the version of what an operation reads, called with the table's latch held
+unsigned long observe_version(const Activity *activity)
+{
+    int table_id = activity->table_id - 1;
+    switch (activity->operation_type)
+    {
+    case OP_READ:
+        if (mvcc)
+        {
+            epoch_enter();
+            unsigned long row_count = atomic_load(&table_versions[table_id])->row_count;
+            epoch_exit();
+            return row_count;
+        }
+        return table_stores[table_id].row_count;
+    case OP_GET:
+        return index_version(table_id, activity->key);
+    case OP_SCAN:
+        return index_range_version(table_id, activity->key, activity->key_end);
+    default:
+        return 0;
+    }
+}
+
+// Function to read for a transaction: the result and its version are taken together under the latch
+void txn_read(TxnEntry *entry)
+{
+    const Activity *activity = entry->activity;
+    TableLockManager *manager = &lock_managers[activity->table_id - 1];
+    pthread_rwlock_rdlock(&manager->latch);
+    if (mvcc && activity->operation_type == OP_READ)
+    {
+        char **rows;
+        epoch_enter();
+        read_snapshot(atomic_load(&table_versions[activity->table_id - 1]), &rows);
+        epoch_exit();
+    }
+    else
+    {
+        apply_read(activity);
+    }
+    entry->observed = observe_version(activity);
+    pthread_rwlock_unlock(&manager->latch);
+}
+
+// Function to check whether what a transaction read is locked for writing by someone else, who may be
+// about to change it. The transaction's own key locks share its timestamp and do not count; with table
+// locks, a table the transaction writes is locked by the transaction itself
+int txn_read_locked(TxnEntry *entries, int count, const Activity *activity, unsigned long timestamp)
+{
+    int table_id = activity->table_id - 1;
+    if (lock_granularity == GRANULARITY_KEY)
+    {
+        TableLockManager *manager = &lock_managers[table_id];
+        LockRequest probe;
+        lock_request_init(&probe, activity, timestamp);
+        int locked = 0;
+        mutex_lock(&manager->mutex);
+        for (LockRequest *holder = manager->granted; holder && !locked; holder = holder->next)
+            locked = requests_conflict(&probe, holder);
+        mutex_unlock(&manager->mutex);
+        return locked;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (entries[i].locked && entries[i].activity->table_id == activity->table_id)
+            return 0;
+    }
+    TableLock *lock = &table_locks[table_id];
+    mutex_lock(&lock->mutex);
+    int locked = lock->writer_active;
+    mutex_unlock(&lock->mutex);
+    return locked;
+}
+
+// Function to check that nothing a transaction read has changed since it was read, and that nobody
+// else holds it locked for writing. Two transactions that each read what the other writes would
+// otherwise both pass, since neither has applied its writes yet
+int txn_validate(TxnEntry *entries, int count, unsigned long timestamp)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const Activity *activity = entries[i].activity;
+        if (is_write_operation(activity->operation_type))
+            continue;
+        if (txn_read_locked(entries, count, activity, timestamp))
+            return 0;
+        TableLockManager *manager = &lock_managers[activity->table_id - 1];
+        pthread_rwlock_rdlock(&manager->latch);
+        unsigned long version = observe_version(activity);
+        pthread_rwlock_unlock(&manager->latch);
+        if (version != entries[i].observed)
+            return 0;
+    }
+    return 1;
+}
+
+// Function to log the writes of a committed transaction with a single write, before its locks are released.
+// Returns what persist_sync waits for and sets the number of writes
+unsigned long txn_persist(TxnEntry *entries, int count, int *logged)
+{
+    size_t length = 0;
+    int writes = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int record_length = format_write_record(NULL, 0, entries[i].activity, entries[i].row);
+        length += record_length;
+        writes += record_length > 0;
+    }
+    *logged = writes;
+    if (length == 0)
+        return 0;
+
+    // Recovery replays the group only if all of its records made it to the log
+    int header_length = format_txn_record(NULL, 0, writes);
+    length += header_length;
+    char *records = malloc(length + 1);
+    char *end = records + format_txn_record(records, header_length + 1, writes);
+    for (int i = 0; i < count; i++)
+        end += format_write_record(end, length + 1 - (end - records), entries[i].activity, entries[i].row);
+    unsigned long lsn = wal_write(records, length);
+    free(records);
+    return lsn;
+}
+
+// Function to run a transaction: the activities thread_activities[first] .. [first + count - 1]
+void run_transaction(int thread_id, int first, int count)
+{
+    TxnEntry *entries = calloc(count > 0 ? count : 1, sizeof(TxnEntry));
+    TxnEntry **order = malloc((count > 0 ? count : 1) * sizeof(TxnEntry *));
+    for (int i = 0; i < count; i++)
+    {
+        entries[i].activity = &activities[thread_activities[first + i]];
+        entries[i].row = -1;
+        order[i] = &entries[i];
+    }
+    qsort(order, count, sizeof(TxnEntry *), compare_txn_entries);
+
+    // A transaction that aborts keeps its timestamp, so under wait-die it only gets older until it wins
+    unsigned long timestamp = atomic_fetch_add(&lock_clock, 1) + 1;
+    unsigned long lsn = 0;
+    int writes = 0;
+    while (1)
+    {
+        if (txn_mode == TXN_2PL)
+        {
+            // Growing phase: take every lock up front, in lock order
+            if (!txn_lock(thread_id, order, count, 0, timestamp))
+            {
+                atomic_fetch_add(&txn_aborts, 1);
+                client_sleep_ns(1000000);
+                continue;
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                const Activity *activity = entries[i].activity;
+                int table_id = activity->table_id - 1;
+                int writer = is_write_operation(activity->operation_type);
+                log_event(writer ? LOG_WRITE_START : LOG_READ_START, thread_id, table_id);
+                replay_hold(activity->duration);
+                if (writer)
+                    entries[i].row = apply_write_latched(activity);
+                else if (mvcc && activity->operation_type == OP_READ)
+                    txn_read(&entries[i]);
+                else
+                    apply_read_latched(activity);
+                log_event(writer ? LOG_WRITE_END : LOG_READ_END, thread_id, table_id);
+            }
+
+            // Shrinking phase: everything is released at commit, after the writes are logged
+            lsn = txn_persist(entries, count, &writes);
+            txn_unlock(order, count);
+            break;
+        }
+
+        // Read phase: reads take no locks, writes are only remembered
+        for (int i = 0; i < count; i++)
+        {
+            const Activity *activity = entries[i].activity;
+            if (is_write_operation(activity->operation_type))
+            {
+                replay_hold(activity->duration);
+                continue;
+            }
+            log_event(LOG_READ_START, thread_id, activity->table_id - 1);
+            replay_hold(activity->duration);
+            txn_read(&entries[i]);
+            log_event(LOG_READ_END, thread_id, activity->table_id - 1);
+        }
+
+        // Commit: lock the writes, then make sure every read is still current
+        for (int i = 0; i < count; i++)
+        {
+            if (is_write_operation(entries[i].activity->operation_type))
+                log_event(LOG_WRITE_WAIT, thread_id, entries[i].activity->table_id - 1);
+        }
+        if (!txn_lock(thread_id, order, count, 1, timestamp))
+        {
+            atomic_fetch_add(&txn_aborts, 1);
+            client_sleep_ns(1000000);
+            continue;
+        }
+        if (!txn_validate(entries, count, timestamp))
+        {
+            txn_unlock(order, count);
+            atomic_fetch_add(&txn_aborts, 1);
+            continue;
+        }
+
+        // Write phase
+        for (int i = 0; i < count; i++)
+        {
+            const Activity *activity = entries[i].activity;
+            if (!is_write_operation(activity->operation_type))
+                continue;
+            log_event(LOG_WRITE_START, thread_id, activity->table_id - 1);
+            entries[i].row = apply_write_latched(activity);
+            log_event(LOG_WRITE_END, thread_id, activity->table_id - 1);
+        }
+        lsn = txn_persist(entries, count, &writes);
+        txn_unlock(order, count);
+        break;
+    }
+
+    atomic_fetch_add(&txn_commits, 1);
+    persist_sync(lsn, writes);
+    free(order);
+    free(entries);
+}
+
+// Function to run a single operation under the concurrency control the options chose
+void perform_activity(int thread_id, const Activity *activity)
+{
+    if (num_owners > 0)
+    {
+        perform_on_owner(thread_id, activity);
+    }
+    else if (activity->operation_type == OP_READ && mvcc)
+    {
+        perform_snapshot_read(thread_id, activity->table_id - 1, activity->duration);
+    }
+    else if (lock_granularity == GRANULARITY_KEY)
+    {
+        perform_with_lock_manager(thread_id, activity);
+    }
+    else if (is_write_operation(activity->operation_type))
+    {
+        perform_write(thread_id, activity);
+    }
+    else
+    {
+        perform_read(thread_id, activity);
+    }
+}
+
+void *thread_function(void *arg)
+{
+    // Get thread id from arguments
+    int thread_id = *(int *)arg;
+    thread_slot = thread_id;
+    if (!current_client)
+        log_slot = thread_id;
+
+    // Walk only this thread's own queue of activities
+    for (int k = thread_offsets[thread_id - 1]; k < thread_offsets[thread_id]; k++)
+    {
+        int i = thread_activities[k];
+
+        // Wait for operation time
+        replay_wait(activities[i].operation_time);
+        long long operation_start = profile_operation_begin();
+
+        // Run the operations up to the matching commit as one transaction
+        if (activities[i].operation_type == OP_BEGIN)
+        {
+            int end = k + 1;
+            while (end < thread_offsets[thread_id] && activities[thread_activities[end]].operation_type != OP_COMMIT)
+                end++;
+            run_transaction(thread_id, k + 1, end - k - 1);
+            profile_operation_end(operation_start);
+            k = end;
+            continue;
+        }
+
+        // Perform read or write operation based on operation type
+        if (activities[i].operation_type == OP_COMMIT)
+            continue;
+        perform_activity(thread_id, &activities[i]);
+        profile_operation_end(operation_start);
+    }
+    return NULL;
+}
+
+// Entry point of a client: runs its trace thread's activities, then returns to the scheduler
+void client_main(int index)
+{
+    thread_function(&clients[index].thread_id);
+    clients[index].finished = 1;
+}
+
+// Worker thread: runs its ready clients one after another until all of them finished
+void *worker_function(void *arg)
+{
+    Worker *worker = arg;
+    log_slot = worker - workers + 1;
+
+    while (worker->live > 0)
+    {
+        // Sleepers whose time has come are ready again
+        long long now = monotonic_ns();
+        while (worker->sleeping_count > 0 && worker->sleeping[0]->wake_ns <= now)
+            client_make_ready(sleeping_pop(worker));
+
+        pthread_mutex_lock(&worker->mutex);
+        Client *client = worker->ready_head;
+        if (!client)
+        {
+            // Idle: wait for a client woken by another thread or for the next sleeper
+            if (worker->sleeping_count > 0)
+            {
+                long long wake_ns = worker->sleeping[0]->wake_ns;
+                struct timespec deadline = {wake_ns / 1000000000LL, wake_ns % 1000000000LL};
+                pthread_cond_timedwait(&worker->wakeup, &worker->mutex, &deadline);
+            }
+            else
+            {
+                pthread_cond_wait(&worker->wakeup, &worker->mutex);
+            }
+            pthread_mutex_unlock(&worker->mutex);
+            continue;
+        }
+        worker->ready_head = client->next;
+        if (!worker->ready_head)
+            worker->ready_tail = NULL;
+        pthread_mutex_unlock(&worker->mutex);
+
+        // Run the client until it parks or finishes
+        current_client = client;
+        thread_slot = client->thread_id;
+        swapcontext(&worker->scheduler, &client->context);
+        current_client = NULL;
+        if (client->finished)
+            worker->live--;
+    }
+    return NULL;
+}
+
+// Function to run the trace threads as clients on --workers worker threads and wait for them
+void run_workers(int num_threads)
+{
+    workers = calloc(num_workers, sizeof(Worker));
+    clients = calloc(num_threads, sizeof(Client));
+
+    // One reservation for all stacks; only the pages a client touches are ever backed by memory
+    client_stacks = mmap(NULL, (size_t)num_threads * CLIENT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (!workers || !clients || client_stacks == MAP_FAILED)
+    {
+        perror("Error allocating clients");
+        exit(EXIT_FAILURE);
+    }
+
+    // Sleepers are timed on CLOCK_MONOTONIC, like the rest of the program
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_mutex_init(&workers[i].mutex, NULL);
+        pthread_cond_init(&workers[i].wakeup, &attributes);
+    }
+    pthread_condattr_destroy(&attributes);
+
+    // Deal the clients round-robin to the workers, all of them ready to start
+    for (int i = 0; i < num_threads; i++)
+    {
+        Client *client = &clients[i];
+        client->thread_id = i + 1;
+        client->worker = i % num_workers;
+        getcontext(&client->context);
+        client->context.uc_stack.ss_sp = client_stacks + (size_t)i * CLIENT_STACK_SIZE;
+        client->context.uc_stack.ss_size = CLIENT_STACK_SIZE;
+        client->context.uc_link = &workers[client->worker].scheduler;
+        makecontext(&client->context, (void (*)(void))client_main, 1, i);
+        workers[client->worker].live++;
+        client_make_ready(client);
+    }
+
+    for (int i = 0; i < num_workers; i++)
+        pthread_create(&workers[i].thread, NULL, worker_function, &workers[i]);
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].mutex);
+        pthread_cond_destroy(&workers[i].wakeup);
+        free(workers[i].sleeping);
+    }
+
+    munmap(client_stacks, (size_t)num_threads * CLIENT_STACK_SIZE);
+    free(clients);
+    free(workers);
+}
+
+// Virtual-time simulation: replays the activities on a virtual clock with the same lock policies,
+// driven by an event priority queue instead of sleeping threads
+
+// Event types of the simulation
+typedef enum
+{
+    EVENT_ARRIVE, // A thread reaches the operation time of its next activity
+    EVENT_FINISH  // A thread finishes the duration of its current activity
+} EventType;
+
+// Event in the simulation's priority queue, ordered by time and then by insertion
+typedef struct
+{
+    long long time;
+    unsigned long sequence;
+    EventType type;
+    int thread_index;
+} SimEvent;
+
+// Simulated thread: the activity it is working on and its place in a lock's wait queue
+typedef struct
+{
+    int position;      // Position of the next activity in the thread's queue
+    int current;       // Index of the current activity, -1 when done
+    int next_waiting;  // Next thread in the same wait queue, -1 at the end
+    int next_active;   // Key granularity: next thread holding locks on the same table, -1 at the end
+    long long wait_start; // Profiler: arrival and entry times of the current activity
+    long long hold_start;
+} SimThread;
+
+// Simulated table lock, mirroring the state of TableLock
+typedef struct
+{
+    int readers;
+    int writer_active;
+    int writers_pending;
+    int queue_head; // Waiting threads in arrival order
+    int queue_tail;
+    int active_head; // Key granularity: threads holding locks on the table
+} SimLock;
+
+SimEvent *sim_events;
+int sim_event_count = 0;
+int sim_event_capacity = 0;
+unsigned long sim_sequence = 0;
+SimThread *sim_threads;
+SimLock *sim_locks;
+
+// Function to compare two events, earlier time first and insertion order on ties
+int sim_event_before(const SimEvent *a, const SimEvent *b)
+{
+    if (a->time != b->time)
+        return a->time < b->time;
+    return a->sequence < b->sequence;
+}
+
+// Function to push an event onto the binary heap
+void sim_push(long long time, EventType type, int thread_index)
+{
+    if (sim_event_count == sim_event_capacity)
+    {
+        sim_event_capacity = sim_event_capacity ? sim_event_capacity * 2 : 1024;
+        sim_events = realloc(sim_events, sim_event_capacity * sizeof(SimEvent));
+        if (!sim_events)
+        {
+            perror("Error allocating events");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sift the new event up to its place
+    int i = sim_event_count++;
+    SimEvent event = {time, sim_sequence++, type, thread_index};
+    while (i > 0 && sim_event_before(&event, &sim_events[(i - 1) / 2]))
+    {
+        sim_events[i] = sim_events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim_events[i] = event;
+}
+
+// Function to pop the earliest event from the binary heap
+SimEvent sim_pop(void)
+{
+    SimEvent top = sim_events[0];
+    SimEvent last = sim_events[--sim_event_count];
+
+    // Sift the last event down from the root
+    int i = 0;
+    while (2 * i + 1 < sim_event_count)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < sim_event_count && sim_event_before(&sim_events[child + 1], &sim_events[child]))
+            child++;
+        if (!sim_event_before(&sim_events[child], &last))
+            break;
+        sim_events[i] = sim_events[child];
+        i = child;
+    }
+    sim_events[i] = last;
+    return top;
+}
+
+// Function to schedule the arrival of a thread's next activity, relative to now like sleep()
+void sim_schedule_next(int thread_index)
+{
+    SimThread *thread = &sim_threads[thread_index];
+    thread->current = -1;
+    if (thread->position < thread_offsets[thread_index + 1])
+    {
+        thread->current = thread_activities[thread->position++];
+        sim_push(sim_now + activities[thread->current].operation_time, EVENT_ARRIVE, thread_index);
+    }
+}
+
+// Function to check whether the current activity of a thread is a write
+int sim_is_writer(int thread_index)
+{
+    return is_write_operation(activities[sim_threads[thread_index].current].operation_type);
+}
+
+// Function to check whether a thread's locks would conflict with the threads holding locks on its table
+int sim_conflicts(SimLock *lock, int thread_index)
+{
+    LockRequest request;
+    lock_request_init(&request, &activities[sim_threads[thread_index].current], 0);
+    for (int active = lock->active_head; active >= 0; active = sim_threads[active].next_active)
+    {
+        LockRequest holder;
+        lock_request_init(&holder, &activities[sim_threads[active].current], 0);
+        if (requests_conflict(&request, &holder))
+            return 1;
+    }
+    return 0;
+}
+
+// Function to remove a thread from the holders of its table's locks
+void sim_deactivate(SimLock *lock, int thread_index)
+{
+    int *link = &lock->active_head;
+    while (*link != thread_index)
+        link = &sim_threads[*link].next_active;
+    *link = sim_threads[thread_index].next_active;
+}
+
+// Function to let a thread into its table: log the start and schedule the end of the activity
+void sim_enter(int thread_index)
+{
+    Activity *activity = &activities[sim_threads[thread_index].current];
+    int table_id = activity->table_id - 1;
+    SimLock *lock = &sim_locks[table_id];
+    sim_threads[thread_index].hold_start =
+        profile_acquired(thread_index + 1, table_id, sim_is_writer(thread_index), sim_threads[thread_index].wait_start);
+
+    // Key granularity: the thread joins the holders of the table's locks
+    int snapshot_read = mvcc && activity->operation_type == OP_READ;
+    if (lock_granularity == GRANULARITY_KEY && !snapshot_read)
+    {
+        sim_threads[thread_index].next_active = lock->active_head;
+        lock->active_head = thread_index;
+    }
+
+    if (sim_is_writer(thread_index))
+    {
+        if (lock_granularity == GRANULARITY_TABLE)
+            lock->writer_active = 1;
+        log_event(LOG_WRITE_START, thread_index + 1, table_id);
+    }
+    else if (snapshot_read)
+    {
+        // Snapshot readers never hold the lock; the snapshot is taken when they start
+        char **rows;
+        read_snapshot(atomic_load(&table_versions[table_id]), &rows);
+        log_event(LOG_READ_START, thread_index + 1, table_id);
+    }
+    else
+    {
+        if (lock_granularity == GRANULARITY_TABLE)
+            lock->readers++;
+        log_event(LOG_READ_START, thread_index + 1, table_id);
+    }
+    sim_push(sim_now + activity->duration, EVENT_FINISH, thread_index);
+}
+
+// Function to check whether the lock policy lets a thread in right now
+int sim_can_enter(SimLock *lock, int thread_index, int queued)
+{
+    if (mvcc && activities[sim_threads[thread_index].current].operation_type == OP_READ)
+        return 1;
+    if (lock_granularity == GRANULARITY_KEY)
+        return !sim_conflicts(lock, thread_index);
+    if (sim_is_writer(thread_index))
+        return !lock->writer_active && lock->readers == 0;
+
+    // Readers go in while no writer is around; under FIFO they also never overtake the queue
+    if (lock->writer_active)
+        return 0;
+    if (lock_policy == POLICY_FIFO)
+        return queued || lock->queue_head < 0;
+    return lock->writers_pending == 0;
+}
+
+// Function to remove a thread from a lock's wait queue
+void sim_dequeue(SimLock *lock, int thread_index, int previous)
+{
+    int next = sim_threads[thread_index].next_waiting;
+    if (previous < 0)
+        lock->queue_head = next;
+    else
+        sim_threads[previous].next_waiting = next;
+    if (lock->queue_tail == thread_index)
+        lock->queue_tail = previous;
+}
+
+// Function to make one pass over a lock's wait queue and admit the threads the policy lets in
+void sim_admit_pass(SimLock *lock, int readers_only)
+{
+    int previous = -1;
+    int current = lock->queue_head;
+    while (current >= 0)
+    {
+        int next = sim_threads[current].next_waiting;
+        int writer = sim_is_writer(current);
+
+        if (readers_only ? !writer : sim_can_enter(lock, current, 1))
+        {
+            sim_dequeue(lock, current, previous);
+            sim_enter(current);
+
+            // Only one writer at a time, and no reader may follow it in
+            if (lock->writer_active)
+                break;
+        }
+        else
+        {
+            // FIFO: nobody overtakes the first thread that has to keep waiting
+            if (lock_policy == POLICY_FIFO)
+                break;
+            previous = current;
+        }
+        current = next;
+    }
+}
+
+// Function to admit waiting threads after the state of a lock changed
+void sim_admit_waiters(SimLock *lock, int write_phase_ended)
+{
+    // Phase-fair: every reader that waited through the write phase starts before the next writer
+    if (lock_policy == POLICY_PHASE_FAIR && write_phase_ended)
+        sim_admit_pass(lock, 1);
+    sim_admit_pass(lock, 0);
+}
+
+// Function to handle a thread arriving at its activity: enter the table or queue up
+void sim_arrive(int thread_index)
+{
+    Activity *activity = &activities[sim_threads[thread_index].current];
+    int table_id = activity->table_id - 1;
+    SimLock *lock = &sim_locks[table_id];
+    sim_threads[thread_index].wait_start = profile_wait_begin(table_id);
+
+    if (sim_is_writer(thread_index))
+    {
+        log_event(LOG_WRITE_WAIT, thread_index + 1, table_id);
+        lock->writers_pending++;
+    }
+
+    // Writers queue behind earlier waiters of the table; readers are checked by the policy.
+    // With key locks only a conflict holds a thread back
+    int may_enter = sim_can_enter(lock, thread_index, 0);
+    if (may_enter && sim_is_writer(thread_index) && lock->queue_head >= 0 && lock_granularity == GRANULARITY_TABLE)
+        may_enter = 0;
+    if (may_enter)
+    {
+        sim_enter(thread_index);
+        return;
+    }
+
+    // Append to the table's wait queue
+    sim_threads[thread_index].next_waiting = -1;
+    if (lock->queue_tail >= 0)
+        sim_threads[lock->queue_tail].next_waiting = thread_index;
+    else
+        lock->queue_head = thread_index;
+    lock->queue_tail = thread_index;
+}
+
+// Function to handle a thread finishing its activity: write, log, release and move on
+void sim_finish(int thread_index)
+{
+    Activity *activity = &activities[sim_threads[thread_index].current];
+    int table_id = activity->table_id - 1;
+    SimLock *lock = &sim_locks[table_id];
+    profile_released(table_id, sim_is_writer(thread_index), sim_threads[thread_index].hold_start);
+    profile_operation_end(sim_threads[thread_index].wait_start);
+
+    if (sim_is_writer(thread_index))
+    {
+        int row = apply_write(activity);
+        persist_sync(persist_write(activity, row), 1);
+        log_event(LOG_WRITE_END, thread_index + 1, table_id);
+        if (lock_granularity == GRANULARITY_KEY)
+            sim_deactivate(lock, thread_index);
+        lock->writer_active = 0;
+        lock->writers_pending--;
+        sim_admit_waiters(lock, 1);
+    }
+    else if (mvcc && activity->operation_type == OP_READ)
+    {
+        log_event(LOG_READ_END, thread_index + 1, table_id);
+    }
+    else
+    {
+        apply_read(activity);
+        log_event(LOG_READ_END, thread_index + 1, table_id);
+        if (lock_granularity == GRANULARITY_KEY)
+            sim_deactivate(lock, thread_index);
+        else
+            lock->readers--;
+        sim_admit_waiters(lock, 0);
+    }
+    sim_schedule_next(thread_index);
+}
+
+// Function to run the whole activity file in virtual time on the calling thread
+void run_virtual_simulation(int num_threads, int num_tables)
+{
+    sim_threads = malloc(num_threads * sizeof(SimThread));
+    sim_locks = calloc(num_tables, sizeof(SimLock));
+    for (int i = 0; i < num_tables; i++)
+    {
+        sim_locks[i].queue_head = -1;
+        sim_locks[i].queue_tail = -1;
+        sim_locks[i].active_head = -1;
+    }
+
+    // Every thread starts with the arrival of its first activity
+    for (int i = 0; i < num_threads; i++)
+    {
+        sim_threads[i].position = thread_offsets[i];
+        sim_threads[i].current = -1;
+        sim_threads[i].next_waiting = -1;
+        sim_schedule_next(i);
+    }
+
+    // Process events in time order until every thread ran out of activities
+    long processed = 0;
+    while (sim_event_count > 0)
+    {
+        SimEvent event = sim_pop();
+        sim_now = event.time;
+        if (event.type == EVENT_ARRIVE)
+            sim_arrive(event.thread_index);
+        else
+            sim_finish(event.thread_index);
+        processed++;
+    }
+
+    printf("Simulated %ld events, virtual time %.3f s\n", processed, sim_now / 1e9);
+    free(sim_threads);
+    free(sim_locks);
+    free(sim_events);
+}
+
+// Function to skip spaces and tabs, stopping at the end of the line
+const char *skip_blanks(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+// Function to scan a decimal integer, returns NULL if there is none
+const char *scan_int(const char *p, const char *end, int *value)
+{
+    p = skip_blanks(p, end);
+    int sign = 1;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        sign = *p == '-' ? -1 : 1;
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9')
+        return NULL;
+
+    // A number that does not fit an int makes the line malformed
+    int result = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (result > (INT_MAX - (*p - '0')) / 10)
+            return NULL;
+        result = result * 10 + (*p++ - '0');
+    }
+    *value = sign * result;
+    return p;
+}
+
+// Function to scan a time: a decimal number of seconds, or a number with an s, ms, us or ns suffix,
+// like "2", "1.5", "250ms" or "30us". Returns NULL if there is none
+const char *scan_time(const char *p, const char *end, long long *nanoseconds)
+{
+    p = skip_blanks(p, end);
+    int sign = 1;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        sign = *p == '-' ? -1 : 1;
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9')
+        return NULL;
+
+    long long whole = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (whole > (LLONG_MAX - (*p - '0')) / 10)
+            return NULL;
+        whole = whole * 10 + (*p++ - '0');
+    }
+
+    // Digits past nanoseconds are dropped
+    long long fraction = 0, scale = 1;
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (scale < 1000000000LL)
+            {
+                fraction = fraction * 10 + (*p - '0');
+                scale *= 10;
+            }
+        }
+    }
+
+    long long unit = 1000000000LL;
+    if (end - p >= 2 && memcmp(p, "ms", 2) == 0)
+        unit = 1000000LL, p += 2;
+    else if (end - p >= 2 && memcmp(p, "us", 2) == 0)
+        unit = 1000LL, p += 2;
+    else if (end - p >= 2 && memcmp(p, "ns", 2) == 0)
+        unit = 1, p += 2;
+    else if (p < end && *p == 's')
+        p++;
+
+    // A time that does not fit in nanoseconds makes the line malformed
+    fraction = fraction * unit / scale;
+    if (whole > (LLONG_MAX - fraction) / unit)
+        return NULL;
+    *nanoseconds = sign * (whole * unit + fraction);
+    return p;
+}
+
+// Function to scan the operation type token
+const char *scan_operation(const char *p, const char *end, OperationType *type)
+{
+    p = skip_blanks(p, end);
+    const char *start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        p++;
+
+    size_t length = p - start;
+    if (length == 4 && memcmp(start, "read", 4) == 0)
+        *type = OP_READ;
+    else if (length == 5 && memcmp(start, "write", 5) == 0)
+        *type = OP_WRITE;
+    else if (length == 3 && memcmp(start, "get", 3) == 0)
+        *type = OP_GET;
+    else if (length == 3 && memcmp(start, "put", 3) == 0)
+        *type = OP_PUT;
+    else if (length == 6 && memcmp(start, "delete", 6) == 0)
+        *type = OP_DELETE;
+    else if (length == 4 && memcmp(start, "scan", 4) == 0)
+        *type = OP_SCAN;
+    else if (length == 5 && memcmp(start, "begin", 5) == 0)
+        *type = OP_BEGIN;
+    else if (length == 6 && memcmp(start, "commit", 6) == 0)
+        *type = OP_COMMIT;
+    else
+        *type = OP_UNKNOWN;
+    return length ? p : NULL;
+}
+
+void parse_activity_file(const char *filename)
+{
+    // Open activity file and map it, the whole file is scanned in place
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening activity file");
+        exit(EXIT_FAILURE);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        perror("Error reading activity file");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = file_stat.st_size;
+    const char *data = "";
+    if (size > 0)
+    {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            perror("Error mapping activity file");
+            exit(EXIT_FAILURE);
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+    const char *end = data + size;
+
+    // First pass: count the lines so the activities are allocated exactly once
+    int num_lines = 0;
+    for (const char *p = data; p < end; p++)
+    {
+        p = memchr(p, '\n', end - p);
+        num_lines++;
+        if (!p)
+            break;
+    }
+    activities = malloc((num_lines > 0 ? num_lines : 1) * sizeof(Activity));
+
+    // Every value is a piece of a line plus its NUL, so the file size bounds the arena
+    value_arena = malloc(size + num_lines + 1);
+    if (!activities || !value_arena)
+    {
+        perror("Error allocating activities");
+        exit(EXIT_FAILURE);
+    }
+    char *arena_end = value_arena;
+
+    // Second pass: parse "<operation_time> <thread_id> <table_id> <operation_type> <duration> [<key> [<last_key>]] <written_value>"
+    const char *line = data;
+    while (line < end)
+    {
+        const char *line_end = memchr(line, '\n', end - line);
+        if (!line_end)
+            line_end = end;
+
+        Activity *activity = &activities[num_activities];
+        const char *p = line;
+        p = p ? scan_time(p, line_end, &activity->operation_time) : NULL;
+        p = p ? scan_int(p, line_end, &activity->thread_id) : NULL;
+        p = p ? scan_int(p, line_end, &activity->table_id) : NULL;
+        p = p ? scan_operation(p, line_end, &activity->operation_type) : NULL;
+        p = p ? scan_time(p, line_end, &activity->duration) : NULL;
+
+        // Key operations name their key, or the first and last key of a scan, before the value
+        activity->key = 0;
+        activity->key_end = 0;
+        if (p && activity->operation_type >= OP_GET && activity->operation_type <= OP_SCAN)
+            p = scan_int(p, line_end, &activity->key);
+        if (p && activity->operation_type == OP_SCAN)
+            p = scan_int(p, line_end, &activity->key_end);
+
+        // Blank or malformed lines are skipped
+        if (p)
+        {
+            // The written value is the rest of the line, without the carriage return of CRLF files
+            p = skip_blanks(p, line_end);
+            const char *value_end = line_end;
+            if (value_end > p && value_end[-1] == '\r')
+                value_end--;
+            memcpy(arena_end, p, value_end - p);
+            activity->written_value = arena_end;
+            arena_end += value_end - p;
+            *arena_end++ = '\0';
+
+            // Increment number of activities
+            num_activities++;
+        }
+        line = line_end + 1;
+    }
+
+    if (size > 0)
+        munmap((void *)data, size);
+    close(fd);
+}
+
+// Server mode (--serve=unix:PATH or --serve=tcp:PORT): instead of replaying a file, every server thread
+// runs an epoll loop over its share of the client connections. Requests are lines like the activity
+// format without time, thread and duration: "<operation> <table_id> [<key> [<last_key>]] [<value>]"
+#define SERVER_READ_SIZE 65536
+#define SERVER_OUTPUT_LIMIT (1 << 20) // Pending reply bytes above which a connection's input is left unread
+#define SERVER_EVENTS 64
+
+// Client connection with its unparsed input and its unsent replies
+typedef struct
+{
+    int fd;
+    char *input;
+    size_t input_length;
+    size_t input_capacity;
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+    size_t output_sent;
+    unsigned int events; // Events the connection is registered for
+} Connection;
+
+const char *serve_address = NULL;
+int server_fd = -1;
+int server_wakeup = -1; // eventfd that wakes every loop for shutdown
+atomic_int server_stop;
+atomic_long server_requests;
+atomic_long server_connections;
+
+// Function to stop the server on SIGINT or SIGTERM
+void server_signal(int signal_number)
+{
+    (void)signal_number;
+    atomic_store(&server_stop, 1);
+    unsigned long long one = 1;
+    if (write(server_wakeup, &one, sizeof(one)) < 0)
+        return;
+}
+
+// Function to make room for length more bytes in a connection buffer
+void buffer_reserve(char **buffer, size_t *capacity, size_t used, size_t length)
+{
+    if (used + length <= *capacity)
+        return;
+    while (used + length > *capacity)
+        *capacity = *capacity ? *capacity * 2 : 4096;
+    *buffer = realloc(*buffer, *capacity);
+    if (!*buffer)
+    {
+        perror("Error allocating connection buffer");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to queue a reply on a connection; replies are sent together once the input is used up
+void connection_reply(Connection *connection, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+
+    buffer_reserve(&connection->output, &connection->output_capacity, connection->output_length, length + 1);
+    va_start(arguments, format);
+    vsnprintf(connection->output + connection->output_length, length + 1, format, arguments);
+    va_end(arguments);
+    connection->output_length += length;
+}
+
+// Function to parse and run one request line, queueing its reply
+void serve_request(int thread_id, Connection *connection, char *line, char *line_end)
+{
+    if (line_end > line && line_end[-1] == '\r')
+        line_end--;
+    *line_end = '\0';
+
+    Activity activity = {0};
+    activity.thread_id = thread_id;
+    const char *p = scan_operation(line, line_end, &activity.operation_type);
+    p = p ? scan_int(p, line_end, &activity.table_id) : NULL;
+    if (p && activity.operation_type >= OP_GET && activity.operation_type <= OP_SCAN)
+        p = scan_int(p, line_end, &activity.key);
+    if (p && activity.operation_type == OP_SCAN)
+        p = scan_int(p, line_end, &activity.key_end);
+    if (!p || activity.operation_type == OP_UNKNOWN || activity.operation_type == OP_BEGIN ||
+        activity.operation_type == OP_COMMIT)
+    {
+        connection_reply(connection, "ERR bad request\n");
+        return;
+    }
+    if (activity.table_id < 1 || activity.table_id > num_tables)
+    {
+        connection_reply(connection, "ERR unknown table\n");
+        return;
+    }
+    activity.written_value = skip_blanks(p, line_end);
+    if ((activity.operation_type == OP_WRITE || activity.operation_type == OP_PUT) && *activity.written_value == '\0')
+    {
+        connection_reply(connection, "ERR missing value\n");
+        return;
+    }
+
+    long long operation_start = profile_operation_begin();
+    reply_count = 0;
+    reply_value = NULL;
+    perform_activity(thread_id, &activity);
+    profile_operation_end(operation_start);
+    atomic_fetch_add_explicit(&server_requests, 1, memory_order_relaxed);
+
+    switch (activity.operation_type)
+    {
+    case OP_GET:
+        if (reply_value)
+            connection_reply(connection, "OK %s\n", reply_value);
+        else
+            connection_reply(connection, "NOT_FOUND\n");
+        free(reply_value);
+        break;
+    case OP_DELETE:
+        connection_reply(connection, reply_count ? "OK\n" : "NOT_FOUND\n");
+        break;
+    case OP_PUT:
+        connection_reply(connection, "OK\n");
+        break;
+    default:
+        connection_reply(connection, "OK %ld\n", reply_count);
+        break;
+    }
+}
+
+// Function to run every complete request in a connection's input, as long as its replies are not piling up
+void connection_process(int thread_id, Connection *connection)
+{
+    char *line = connection->input;
+    char *end = connection->input + connection->input_length;
+    char *newline;
+    while (connection->output_length - connection->output_sent < SERVER_OUTPUT_LIMIT &&
+           (newline = memchr(line, '\n', end - line)))
+    {
+        serve_request(thread_id, connection, line, newline);
+        line = newline + 1;
+    }
+    connection->input_length = end - line;
+    memmove(connection->input, line, connection->input_length);
+}
+
+// Function to send as much of the queued replies as the socket takes. Returns 0 if the connection broke
+int connection_flush(Connection *connection)
+{
+    while (connection->output_sent < connection->output_length)
+    {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_sent,
+                            connection->output_length - connection->output_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (sent <= 0)
+            return 0;
+        connection->output_sent += sent;
+    }
+    if (connection->output_sent == connection->output_length)
+    {
+        connection->output_sent = 0;
+        connection->output_length = 0;
+    }
+    return 1;
+}
+
+// Function to register for input while replies are not piling up, and for output while some are unsent
+void connection_update_events(int epoll_fd, Connection *connection)
+{
+    size_t pending = connection->output_length - connection->output_sent;
+    unsigned int events = (pending < SERVER_OUTPUT_LIMIT ? EPOLLIN : 0) | (pending > 0 ? EPOLLOUT : 0);
+    if (events == connection->events)
+        return;
+    struct epoll_event event = {.events = events, .data.ptr = connection};
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+}
 
-// Semaphore initialization
-sem_t *mutex, *write_lock;
+// Function to close a connection and free its buffers
+void connection_close(int epoll_fd, Connection *connection)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    free(connection->input);
+    free(connection->output);
+    free(connection);
+}
 
-// Read count initialization
-int *read_count;
+// Function to handle readiness of a connection: read what arrived, run the requests, send the replies.
+// Returns 0 once the connection is closed
+int connection_ready(int thread_id, int epoll_fd, Connection *connection, unsigned int events)
+{
+    int alive = !(events & (EPOLLERR | EPOLLHUP)) || (events & EPOLLIN);
+    if (alive && (events & EPOLLOUT))
+    {
+        // A connection that failed to flush is gone, its buffered requests are not run
+        alive = connection_flush(connection);
+        if (alive)
+            connection_process(thread_id, connection);
+    }
+    if (alive && (events & EPOLLIN))
+    {
+        // Read until the socket is drained, so pipelined requests are answered in one batch
+        while (1)
+        {
+            buffer_reserve(&connection->input, &connection->input_capacity, connection->input_length, SERVER_READ_SIZE);
+            ssize_t count = read(connection->fd, connection->input + connection->input_length, SERVER_READ_SIZE);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (count <= 0)
+            {
+                alive = 0;
+                break;
+            }
+            connection->input_length += count;
+            connection_process(thread_id, connection);
+            if (connection->output_length - connection->output_sent >= SERVER_OUTPUT_LIMIT)
+                break;
+        }
+    }
+    if (connection->output_length > connection->output_sent && !connection_flush(connection))
+        alive = 0;
+    if (!alive)
+    {
+        connection_close(epoll_fd, connection);
+        return 0;
+    }
+    connection_update_events(epoll_fd, connection);
+    return 1;
+}
 
-// Activity structure
-typedef struct
+// Server thread: accepts connections and serves them with its own epoll loop. All loops wait on the
+// listening socket with EPOLLEXCLUSIVE, so a new connection wakes one of them
+void *server_thread(void *arg)
 {
-    int operation_time;
-    int thread_id;
-    int table_id;
-    char operation_type[6];
-    int duration;
-    char *written_value;
-} Activity;
+    int thread_id = *(int *)arg;
+    thread_slot = thread_id;
+    log_slot = thread_id;
+    collect_reply = 1;
 
-// Activity initialization
-Activity *activities;
-// Number of activities
-int num_activities = 0;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        perror("Error creating epoll instance");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &server_fd};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event);
+    event.events = EPOLLIN;
+    event.data.ptr = &server_wakeup;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_wakeup, &event);
 
-// Thread initialization
-pthread_t *threads;
+    // The loop's connections, closed at shutdown
+    Connection **connections = NULL;
+    int num_connections = 0, connections_capacity = 0;
 
-// Table initialization
-char **tables;
+    struct epoll_event events[SERVER_EVENTS];
+    while (!atomic_load(&server_stop))
+    {
+        int count = epoll_wait(epoll_fd, events, SERVER_EVENTS, -1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+        {
+            perror("Error waiting for events");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == &server_wakeup)
+                continue;
+            if (events[i].data.ptr == &server_fd)
+            {
+                int fd;
+                while ((fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    Connection *connection = calloc(1, sizeof(Connection));
+                    if (!connection)
+                    {
+                        perror("Error allocating connection");
+                        exit(EXIT_FAILURE);
+                    }
+                    connection->fd = fd;
+                    connection->events = EPOLLIN;
+                    struct epoll_event connection_event = {.events = EPOLLIN, .data.ptr = connection};
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &connection_event);
+                    if (num_connections == connections_capacity)
+                    {
+                        connections_capacity = connections_capacity ? connections_capacity * 2 : 16;
+                        connections = realloc(connections, connections_capacity * sizeof(Connection *));
+                        if (!connections)
+                        {
+                            perror("Error allocating connections");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    connections[num_connections++] = connection;
+                    atomic_fetch_add(&server_connections, 1);
+                }
+                continue;
+            }
 
-// Log file initialization
-FILE *log_file;
+            Connection *connection = events[i].data.ptr;
+            if (!connection_ready(thread_id, epoll_fd, connection, events[i].events))
+            {
+                for (int k = 0; k < num_connections; k++)
+                {
+                    if (connections[k] == connection)
+                    {
+                        connections[k] = connections[--num_connections];
+                        break;
+                    }
+                }
+            }
+        }
+    }
 
-// Funtion to create file with given filename
-void create_file(const char *filename)
+    for (int k = 0; k < num_connections; k++)
+        connection_close(epoll_fd, connections[k]);
+    free(connections);
+    close(epoll_fd);
+    return NULL;
+}
+
+// Function to open the listening socket of --serve: "unix:PATH" or "tcp:PORT" on the loopback interface
+int server_listen(const char *address)
 {
-    FILE *file = fopen(filename, "w");
-    if (!file)
+    int fd;
+    if (strncmp(address, "unix:", 5) == 0)
     {
-        fprintf(stderr, "Error creating table: %s\n", filename);
-        perror("Error");
+        struct sockaddr_un unix_address = {.sun_family = AF_UNIX};
+        if (strlen(address + 5) >= sizeof(unix_address.sun_path))
+        {
+            fprintf(stderr, "Socket path too long: %s\n", address + 5);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(unix_address.sun_path, address + 5);
+        unlink(unix_address.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) != 0)
+        {
+            perror("Error binding socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strncmp(address, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in tcp_address = {.sin_family = AF_INET, .sin_port = htons(atoi(address + 4))};
+        tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd < 0 || bind(fd, (struct sockaddr *)&tcp_address, sizeof(tcp_address)) != 0)
+        {
+            perror("Error binding socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Unknown server address: %s\n", address);
         exit(EXIT_FAILURE);
     }
-    fclose(file);
+    if (listen(fd, SOMAXCONN) != 0)
+    {
+        perror("Error listening");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
 }
 
-// Function to perform read operation
-void perform_read(int thread_id, int table_id, int duration)
+// Function to serve requests on num_threads server threads until SIGINT or SIGTERM
+void run_server(int num_threads)
 {
-    // Wait for mutex
-    sem_wait(&mutex[table_id]);
-    
-    // Increment read count
-    read_count[table_id]++;
-
-    // If first reader, wait for write lock
-    if (read_count[table_id] == 1)
-        sem_wait(&write_lock[table_id]);
-    
-    // Release mutex for other readers
-    sem_post(&mutex[table_id]);
-
-    // Reading operation
-    fprintf(log_file, "Reader %d started reading %s\n", thread_id, tables[table_id]);
-    fflush(log_file);
-
-    // Wait for duration
-    sleep(duration);
-
-    /*Read Operation*/
+    server_fd = server_listen(serve_address);
+    server_wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (server_wakeup < 0)
+    {
+        perror("Error creating eventfd");
+        exit(EXIT_FAILURE);
+    }
+    struct sigaction action = {.sa_handler = server_signal};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    // Log the end of reading
-    fprintf(log_file, "Reader %d finished reading %s\n", thread_id, tables[table_id]);
-    fflush(log_file);
+    printf("Serving on %s with %d threads\n", serve_address, num_threads);
+    fflush(stdout);
+    pthread_t *server_threads = malloc(num_threads * sizeof(pthread_t));
+    int *thread_ids = malloc(num_threads * sizeof(int));
+    for (int i = 0; i < num_threads; i++)
+    {
+        thread_ids[i] = i + 1;
+        pthread_create(&server_threads[i], NULL, server_thread, &thread_ids[i]);
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(server_threads[i], NULL);
 
-    // Wait for mutex
-    sem_wait(&mutex[table_id]);
-    // Decrement read count
-    read_count[table_id]--;
-    // If last reader, release write lock
-    if (read_count[table_id] == 0)
-        sem_post(&write_lock[table_id]);
-    // Release mutex for other readers
-    sem_post(&mutex[table_id]);
+    close(server_fd);
+    close(server_wakeup);
+    if (strncmp(serve_address, "unix:", 5) == 0)
+        unlink(serve_address + 5);
+    printf("Served %ld requests on %ld connections\n", atomic_load(&server_requests), atomic_load(&server_connections));
+    free(server_threads);
+    free(thread_ids);
 }
 
+// Lock microbenchmark (--lock-bench): the mutexes and table locks against the two-semaphore
+// table lock this program started with, at 1 to 64 threads
+#define LOCK_BENCH_MS 200
 
-// Function to perform write operation
-void perform_write(int thread_id, int table_id, int duration, const char *value)
+typedef enum
 {
-    fprintf(log_file, "Writer %d waiting to write to %s\n", thread_id, tables[table_id]);
+    BENCH_SEMAPHORE, // sem_t as a mutex, or the sem_t pair as a table lock
+    BENCH_PTHREAD,   // pthread_mutex_t
+    BENCH_FUTEX,     // Mutex / TableLock with the futex mutex
+    BENCH_MCS        // Mutex / TableLock with the MCS mutex
+} BenchLock;
 
-    // Wait for write lock
-    sem_wait(&write_lock[table_id]);
+BenchLock bench_lock;
+int lock_bench = 0; // Run the microbenchmark instead of an activity file
+int bench_table; // 0 measures mutexes, 1 table locks with 90% reads
+atomic_int bench_stop;
+sem_t bench_semaphore;  // The mutex of the sem_t versions
+sem_t bench_write_lock; // Held by the writer or by the readers as a group
+int bench_read_count;
+pthread_mutex_t bench_pthread_mutex = PTHREAD_MUTEX_INITIALIZER;
+Mutex bench_mutex;
+TableLock bench_table_lock;
+long bench_counter; // The shared data of the critical sections
 
-    // Writing operation
-    fprintf(log_file, "Writer %d started writing to %s\n", thread_id, tables[table_id]);
-    fflush(log_file);
+// Function to run one critical section with the benchmarked lock
+void lock_bench_operation(int writer)
+{
+    if (!bench_table)
+    {
+        if (bench_lock == BENCH_SEMAPHORE)
+            sem_wait(&bench_semaphore);
+        else if (bench_lock == BENCH_PTHREAD)
+            pthread_mutex_lock(&bench_pthread_mutex);
+        else
+            mutex_lock(&bench_mutex);
+        bench_counter++;
+        if (bench_lock == BENCH_SEMAPHORE)
+            sem_post(&bench_semaphore);
+        else if (bench_lock == BENCH_PTHREAD)
+            pthread_mutex_unlock(&bench_pthread_mutex);
+        else
+            mutex_unlock(&bench_mutex);
+        return;
+    }
 
-    // Wait for duration
-    sleep(duration);
+    if (bench_lock == BENCH_SEMAPHORE)
+    {
+        // The original reader-writer protocol: the first reader locks writers out, the last lets them in
+        if (writer)
+        {
+            sem_wait(&bench_write_lock);
+            bench_counter++;
+            sem_post(&bench_write_lock);
+            return;
+        }
+        sem_wait(&bench_semaphore);
+        if (++bench_read_count == 1)
+            sem_wait(&bench_write_lock);
+        sem_post(&bench_semaphore);
+        (void)*(volatile long *)&bench_counter;
+        sem_wait(&bench_semaphore);
+        if (--bench_read_count == 0)
+            sem_post(&bench_write_lock);
+        sem_post(&bench_semaphore);
+    }
+    else if (writer)
+    {
+        acquire_write(&bench_table_lock);
+        bench_counter++;
+        release_write(&bench_table_lock);
+    }
+    else
+    {
+        int shard = acquire_read(&bench_table_lock);
+        (void)*(volatile long *)&bench_counter;
+        release_read(&bench_table_lock, shard);
+    }
+}
 
-    // Write value to table file
-    FILE *table_file = fopen(tables[table_id], "a");
-    if (table_file)
+// Benchmark thread: runs critical sections until told to stop, returns how many it ran
+void *lock_bench_thread(void *arg)
+{
+    unsigned long random = (unsigned long)arg * 2654435761UL + 1;
+    long operations = 0;
+    while (!atomic_load_explicit(&bench_stop, memory_order_relaxed))
     {
-        fprintf(table_file, "%s\n", value);
-        fclose(table_file);
+        for (int i = 0; i < 64; i++)
+        {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            lock_bench_operation(random % 10 == 0);
+        }
+        operations += 64;
     }
+    return (void *)operations;
+}
 
-    // Log the end of writing
-    fprintf(log_file, "Writer %d finished writing to %s\n", thread_id, tables[table_id]);
-    fflush(log_file);
+// Function to run the benchmark threads for LOCK_BENCH_MS and return millions of operations per second
+double lock_bench_run(int num_threads)
+{
+    pthread_t bench_threads[64];
+    atomic_store(&bench_stop, 0);
+    for (int i = 0; i < num_threads; i++)
+        pthread_create(&bench_threads[i], NULL, lock_bench_thread, (void *)(unsigned long)(i + 1));
 
-    // Release write lock
-    sem_post(&write_lock[table_id]);
+    long long start = monotonic_ns();
+    struct timespec pause = {LOCK_BENCH_MS / 1000, (LOCK_BENCH_MS % 1000) * 1000000};
+    nanosleep(&pause, NULL);
+    atomic_store(&bench_stop, 1);
+
+    long operations = 0;
+    for (int i = 0; i < num_threads; i++)
+    {
+        void *result;
+        pthread_join(bench_threads[i], &result);
+        operations += (long)result;
+    }
+    return operations / ((monotonic_ns() - start) / 1000.0);
 }
 
-void *thread_function(void *arg)
+// Function to run the whole lock microbenchmark and print one table for mutexes, one for table locks
+void run_lock_bench(void)
 {
-    // Get thread id from arguments
-    int thread_id = *(int *)arg;
+    num_reader_shards = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_reader_shards < 1)
+        num_reader_shards = 1;
+    if (num_reader_shards > MAX_READER_SHARDS)
+        num_reader_shards = MAX_READER_SHARDS;
+    sem_init(&bench_semaphore, 0, 1);
+    sem_init(&bench_write_lock, 0, 1);
+    mutex_init(&bench_mutex);
+    table_lock_init(&bench_table_lock);
 
-    // Iterate through activities to find activities for this thread
-    for (int i = 0; i < num_activities; i++)
+    const char *titles[] = {"Mutex, one shared counter", "Table lock, 90% reads"};
+    for (bench_table = 0; bench_table <= 1; bench_table++)
     {
-        // If activity is not for this thread, skip
-        if (activities[i].thread_id != thread_id)
-            continue;
+        printf("%s (million operations/s)\n", titles[bench_table]);
+        printf("%-8s %10s %10s %10s %10s\n", "threads", bench_table ? "sem pair" : "sem_t",
+               bench_table ? "" : "pthread", "futex", "mcs");
+        for (int num_threads = 1; num_threads <= 64; num_threads *= 2)
+        {
+            printf("%-8d", num_threads);
+            for (bench_lock = BENCH_SEMAPHORE; bench_lock <= BENCH_MCS; bench_lock++)
+            {
+                // The table lock has no pthread variant
+                if (bench_table && bench_lock == BENCH_PTHREAD)
+                {
+                    printf(" %10s", "");
+                    continue;
+                }
+                mutex_kind = bench_lock == BENCH_MCS ? MUTEX_MCS : MUTEX_FUTEX;
+                printf(" %10.2f", lock_bench_run(num_threads));
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
 
-        // Wait for operation time
-        sleep(activities[i].operation_time);
+    table_lock_destroy(&bench_table_lock);
+    sem_destroy(&bench_semaphore);
+    sem_destroy(&bench_write_lock);
+}
 
-        // Perform read or write operation based on operation type
-        int table_id = activities[i].table_id - 1;
-        if (strcmp(activities[i].operation_type, "read") == 0)
+// Function to strip the leading options from the argument list
+void parse_options(int *argc, char *argv[])
+{
+    while (*argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strcmp(argv[1], "--lock-policy=writer") == 0)
+        {
+            lock_policy = POLICY_WRITER_PREFERENCE;
+        }
+        else if (strcmp(argv[1], "--lock-policy=fifo") == 0)
+        {
+            lock_policy = POLICY_FIFO;
+        }
+        else if (strcmp(argv[1], "--lock-policy=phase") == 0)
+        {
+            lock_policy = POLICY_PHASE_FAIR;
+        }
+        else if (strcmp(argv[1], "--lock-granularity=table") == 0)
+        {
+            lock_granularity = GRANULARITY_TABLE;
+        }
+        else if (strcmp(argv[1], "--lock-granularity=key") == 0)
+        {
+            lock_granularity = GRANULARITY_KEY;
+        }
+        else if (strcmp(argv[1], "--virtual") == 0)
+        {
+            virtual_time = 1;
+        }
+        else if (strncmp(argv[1], "--compact-every=", 16) == 0)
+        {
+            compact_every = atoi(argv[1] + 16);
+        }
+        else if (strcmp(argv[1], "--log-format=text") == 0)
+        {
+            log_binary = 0;
+        }
+        else if (strcmp(argv[1], "--log-format=binary") == 0)
+        {
+            log_binary = 1;
+        }
+        else if (strcmp(argv[1], "--txn=occ") == 0)
+        {
+            txn_mode = TXN_OCC;
+        }
+        else if (strcmp(argv[1], "--txn=2pl") == 0)
+        {
+            txn_mode = TXN_2PL;
+        }
+        else if (strcmp(argv[1], "--mvcc") == 0)
+        {
+            mvcc = 1;
+        }
+        else if (strcmp(argv[1], "--sync") == 0)
+        {
+            sync_writes = 1;
+        }
+        else if (strncmp(argv[1], "--buffer-pool=", 14) == 0)
+        {
+            buffer_pool_pages = atoi(argv[1] + 14);
+        }
+        else if (strncmp(argv[1], "--serve=", 8) == 0)
+        {
+            serve_address = argv[1] + 8;
+        }
+        else if (strncmp(argv[1], "--speed=", 8) == 0) // "100x" or "100"; atof stops at the x
+        {
+            replay_speed = atof(argv[1] + 8);
+        }
+        else if (strcmp(argv[1], "--fresh") == 0)
+        {
+            fresh_start = 1;
+        }
+        else if (strcmp(argv[1], "--group-commit") == 0)
+        {
+            group_commit = 1;
+        }
+        else if (strncmp(argv[1], "--commit-batch=", 15) == 0)
+        {
+            commit_batch = atoi(argv[1] + 15);
+            if (commit_batch < 1)
+                commit_batch = 1;
+        }
+        else if (strncmp(argv[1], "--commit-latency-us=", 20) == 0)
+        {
+            commit_latency_us = atol(argv[1] + 20);
+        }
+        else if (strcmp(argv[1], "--mutex=futex") == 0)
+        {
+            mutex_kind = MUTEX_FUTEX;
+        }
+        else if (strcmp(argv[1], "--mutex=mcs") == 0)
+        {
+            mutex_kind = MUTEX_MCS;
+        }
+        else if (strcmp(argv[1], "--lock-bench") == 0)
+        {
+            lock_bench = 1;
+        }
+        else if (strncmp(argv[1], "--shared-nothing=", 17) == 0)
+        {
+            num_owners = atoi(argv[1] + 17);
+        }
+        else if (strncmp(argv[1], "--workers=", 10) == 0)
+        {
+            num_workers = atoi(argv[1] + 10);
+        }
+        else if (strncmp(argv[1], "--profile=", 10) == 0)
+        {
+            profile_filename = argv[1] + 10;
+        }
+        else if (strncmp(argv[1], "--profile-interval=", 19) == 0)
+        {
+            profile_interval_ms = atol(argv[1] + 19);
+        }
+        else if (strncmp(argv[1], "--starvation-ms=", 16) == 0)
+        {
+            starvation_ns = atol(argv[1] + 16) * 1000000LL;
+        }
+        else
         {
-            perform_read(thread_id, table_id, activities[i].duration);
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            exit(EXIT_FAILURE);
         }
-        else if (strcmp(activities[i].operation_type, "write") == 0)
+
+        // Shift the remaining arguments left over the consumed option
+        for (int i = 1; i < *argc - 1; i++)
         {
-            perform_write(thread_id, table_id, activities[i].duration, activities[i].written_value);
+            argv[i] = argv[i + 1];
         }
+        (*argc)--;
     }
-    return NULL;
 }
 
-void parse_activity_file(const char *filename)
+// Compare function for sorting a thread's activities by operation time, keeping file order on ties
+int compare_activities(const void *a, const void *b)
 {
-    // Open activity file
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    int index1 = *(const int *)a;
+    int index2 = *(const int *)b;
+    if (activities[index1].operation_time != activities[index2].operation_time)
+        return activities[index1].operation_time < activities[index2].operation_time ? -1 : 1;
+    return index1 - index2;
+}
+
+// Function to check that an activity refers to an existing thread and table
+int activity_is_valid(const Activity *activity, int num_threads, int num_tables)
+{
+    // begin and commit do not touch a table, their table_id is ignored
+    if (activity->operation_type == OP_BEGIN || activity->operation_type == OP_COMMIT)
+        return activity->thread_id >= 1 && activity->thread_id <= num_threads;
+    return activity->thread_id >= 1 && activity->thread_id <= num_threads &&
+           activity->table_id >= 1 && activity->table_id <= num_tables &&
+           activity->operation_type != OP_UNKNOWN;
+}
+
+// Function to group the activities by thread into CSR queues, so each thread walks only its own work
+void build_thread_queues(int num_threads, int num_tables)
+{
+    thread_offsets = calloc(num_threads + 1, sizeof(int));
+    thread_activities = malloc((num_activities > 0 ? num_activities : 1) * sizeof(int));
+    if (!thread_offsets || !thread_activities)
     {
-        perror("Error opening activity file");
+        perror("Error allocating activity queues");
         exit(EXIT_FAILURE);
     }
 
-    // Parse each line of the activity file
-    // Maximum line length is 1024
-    char line[1024];
-
-    // Read each line of the file
-    while (fgets(line, sizeof(line), file))
+    // Count the activities of every thread; activities of unknown threads, tables or operations are never run
+    for (int i = 0; i < num_activities; i++)
     {
-        // Reallocate memory for activities
-        activities = realloc(activities, (num_activities + 1) * sizeof(Activity));
-        // Get pointer to new activity
-        Activity *activity = &activities[num_activities];
-        // Allocate memory for written value
-        activity->written_value = malloc(1024);
+        if (activity_is_valid(&activities[i], num_threads, num_tables))
+            thread_offsets[activities[i].thread_id]++;
+    }
 
-        // Parse activity line
-        sscanf(line, "%d %d %d %s %d %[^\n]",
-               &activity->operation_time,
-               &activity->thread_id,
-               &activity->table_id,
-               activity->operation_type,
-               &activity->duration,
-               activity->written_value);
+    // Prefix sums turn the counts into the start offset of every thread's queue
+    for (int t = 1; t <= num_threads; t++)
+        thread_offsets[t] += thread_offsets[t - 1];
 
-        // Increment number of activities
-        num_activities++;
+    // Scatter the activity indices into their queues, in file order
+    int *fill = malloc((num_threads + 1) * sizeof(int));
+    memcpy(fill, thread_offsets, (num_threads + 1) * sizeof(int));
+    for (int i = 0; i < num_activities; i++)
+    {
+        if (activity_is_valid(&activities[i], num_threads, num_tables))
+            thread_activities[fill[activities[i].thread_id - 1]++] = i;
     }
+    free(fill);
 
-    fclose(file);
+    // Order each queue by operation time
+    for (int t = 0; t < num_threads; t++)
+    {
+        qsort(&thread_activities[thread_offsets[t]], thread_offsets[t + 1] - thread_offsets[t],
+              sizeof(int), compare_activities);
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 4)
+    parse_options(&argc, argv);
+
+    // Spinning on a single CPU only keeps the holder from running
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+        mutex_max_spins = 0;
+    if (lock_bench)
     {
-        fprintf(stderr, "Usage: %s <Number_of_threads> <Number_of_tables> <Activity_file>\n", argv[0]);
+        run_lock_bench();
+        return EXIT_SUCCESS;
+    }
+
+    if (argc != (serve_address ? 3 : 4) || !(replay_speed > 0))
+    {
+        fprintf(stderr, "Usage: %s [--serve=unix:PATH|tcp:PORT] [--lock-policy=writer|fifo|phase] [--lock-granularity=table|key] [--virtual] [--log-format=text|binary] [--txn=occ|2pl] [--mvcc] [--compact-every=N] [--speed=Nx] [--sync] [--fresh] [--buffer-pool=PAGES] [--group-commit] [--commit-batch=N] [--commit-latency-us=U] [--profile=FILE] [--profile-interval=MS] [--starvation-ms=MS] [--workers=N] [--shared-nothing=N] [--mutex=futex|mcs] [--lock-bench] <Number_of_threads> <Number_of_tables> <Activity_file>\n"
+                        "With --serve there is no activity file and <Number_of_threads> server threads answer requests\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     // Get number of threads, number of tables, and activity file from arguments
     int num_threads = atoi(argv[1]);
-    int num_tables = atoi(argv[2]);
+    num_tables = atoi(argv[2]);
     const char *activity_file = argv[3];
 
-    // Allocate memory for tables, semaphores, and read counts
+    // Server threads answer with the result of each operation, which the virtual clock and the owners cannot give
+    if (serve_address && (virtual_time || num_owners > 0))
+    {
+        fprintf(stderr, "--serve cannot be combined with --virtual or --shared-nothing\n");
+        return EXIT_FAILURE;
+    }
+    if (serve_address)
+        num_workers = 0;
+
+    // With --mvcc every read is served from a snapshot in memory, so the pool would never be used
+    if (mvcc && buffer_pool_pages > 0)
+    {
+        fprintf(stderr, "--buffer-pool cannot be combined with --mvcc\n");
+        return EXIT_FAILURE;
+    }
+
+    // The virtual replay runs on one thread already, there is nothing to route
+    if (virtual_time || num_owners < 0)
+        num_owners = 0;
+
+    // One reader counter per CPU, capped to keep the writer's drain check short
+    num_reader_shards = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_reader_shards < 1)
+        num_reader_shards = 1;
+    if (num_reader_shards > MAX_READER_SHARDS)
+        num_reader_shards = MAX_READER_SHARDS;
+
+    // Allocate memory for tables and locks
     tables = malloc(num_tables * sizeof(char *));
-    mutex = malloc(num_tables * sizeof(sem_t));
-    write_lock = malloc(num_tables * sizeof(sem_t));
-    read_count = calloc(num_tables, sizeof(int));
+    table_locks = aligned_alloc(CACHE_LINE_SIZE, num_tables * sizeof(TableLock));
+    lock_managers = aligned_alloc(CACHE_LINE_SIZE, num_tables * sizeof(TableLockManager));
+    table_stores = calloc(num_tables, sizeof(TableStore));
+    if (buffer_pool_pages > 0)
+        pool_init(num_tables);
+    table_versions = malloc(num_tables * sizeof(*table_versions));
+
+    // One epoch slot per thread plus one for the main thread and one per table owner
+    num_epoch_slots = num_threads + 1 + num_owners;
+    epoch_slots = aligned_alloc(CACHE_LINE_SIZE, num_epoch_slots * sizeof(EpochSlot));
+    if (!epoch_slots)
+    {
+        perror("Error allocating epoch slots");
+        return EXIT_FAILURE;
+    }
+    memset(epoch_slots, 0, num_epoch_slots * sizeof(EpochSlot));
+    replay_timelines = calloc(num_threads + 1, sizeof(ReplayTimeline));
 
-    // Create tables and initialize semaphores
+    // Create tables and initialize locks
     for (int i = 0; i < num_tables; i++)
     {
         // Allocate memory for table name
         tables[i] = malloc(16);
 
         sprintf(tables[i], "tbl%d.txt", i + 1);
-        create_file(tables[i]);
+        if (fresh_start)
+        {
+            create_file(tables[i]);
+            table_file_swap(i, tables[i], 0, 0);
+        }
+
+        // Initialize the reader-writer lock of the table
+        table_lock_init(&table_locks[i]);
+        lock_manager_init(&lock_managers[i]);
 
-        // Initialize mutex as 1, write lock as 1
-        sem_init(&mutex[i], 0, 1);
-        sem_init(&write_lock[i], 0, 1);
+        // Every table starts with an empty committed version
+        TableVersion *empty = calloc(1, sizeof(TableVersion));
+        atomic_init(&table_versions[i], empty);
     }
 
-    // Parse activity file
-    parse_activity_file(activity_file);
+    // Load the tables and replay the log of the previous run, then open a new log
+    crc32_init();
+    if (fresh_start)
+        unlink(WAL_OLD_FILENAME);
+    else
+        recover_tables();
+    wal_open();
+    if (group_commit)
+        pthread_create(&commit_thread, NULL, commit_flusher, NULL);
 
-    // Open log file
-    log_file = fopen("logfile.txt", "w");
+    // Parse activity file and split it into per-thread queues
+    if (!serve_address)
+    {
+        parse_activity_file(activity_file);
+        build_thread_queues(num_threads, num_tables);
+    }
+
+    // An owner applies one operation at a time, a transaction may span tables of several owners
+    for (int i = 0; num_owners > 0 && i < num_activities; i++)
+    {
+        if (activities[i].operation_type == OP_BEGIN || activities[i].operation_type == OP_COMMIT)
+        {
+            fprintf(stderr, "Transactions cannot be run with --shared-nothing\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Open log file and start the log writer
+    log_file = fopen(log_binary ? "logfile.bin" : "logfile.txt", "w");
     if (!log_file)
     {
         perror("Error opening log file");
         return EXIT_FAILURE;
     }
+    // Clients log through the ring of their worker, table owners through rings after the producers'
+    int run_on_workers = num_workers > 0 && !virtual_time;
+    int num_producers = run_on_workers ? num_workers : num_threads;
+    log_start(num_producers + num_owners);
+    if (num_owners > 0)
+        owners_start(num_producers + 1);
+    profile_start(num_threads);
+
+    // Every thread's first gap counts from the same instant, however late the thread itself starts
+    replay_epoch_ns = monotonic_ns();
+    for (int i = 0; i <= num_threads; i++)
+        replay_timelines[i].planned = replay_epoch_ns;
+
+    // In virtual time the whole replay runs on this thread
+    if (virtual_time)
+    {
+        // The simulation models single operations only
+        for (int i = 0; i < num_activities; i++)
+        {
+            if (activities[i].operation_type == OP_BEGIN || activities[i].operation_type == OP_COMMIT)
+            {
+                fprintf(stderr, "Transactions cannot be replayed with --virtual\n");
+                return EXIT_FAILURE;
+            }
+        }
+        run_virtual_simulation(num_threads, num_tables);
+        num_threads = 0;
+    }
+    else if (run_on_workers)
+    {
+        run_workers(num_threads);
+        num_threads = 0;
+    }
+    else if (serve_address)
+    {
+        run_server(num_threads);
+        num_threads = 0;
+    }
 
     // Create threads
     threads = malloc(num_threads * sizeof(pthread_t));
@@ -250,26 +5323,78 @@ int main(int argc, char *argv[])
         pthread_join(threads[i], NULL);
     }
 
+    // Every request was answered, so the owners can go; the final compaction takes the table locks
+    if (num_owners > 0)
+        owners_stop();
+
+    profile_stop();
+    log_stop();
     fclose(log_file);
 
-    // Free memory and destroy semaphores for each table
+    if (group_commit)
+    {
+        commit_stop();
+        printf("Group commit: %ld records in %ld batches\n", commit_records, commit_batches);
+    }
+    if (buffer_pool_pages > 0)
+    {
+        long accesses = pool_hits + pool_misses;
+        printf("Buffer pool: %ld hits, %ld misses (%.1f%% hit rate), %ld evictions\n", pool_hits, pool_misses,
+               accesses ? 100.0 * pool_hits / accesses : 0.0, pool_evictions);
+    }
+
+    // Write the final state of every table to its file
+    compact_tables();
+    close(wal_fd);
+    printf("Rows read: %ld\n", atomic_load(&rows_read));
+    if (atomic_load(&txn_commits) > 0)
+        printf("Transactions: %ld committed, %ld aborted\n", atomic_load(&txn_commits), atomic_load(&txn_aborts));
+
+    // Free memory and destroy locks for each table
     for (int i = 0; i < num_tables; i++)
     {
-        sem_destroy(&mutex[i]);
-        sem_destroy(&write_lock[i]);
+        table_lock_destroy(&table_locks[i]);
+        lock_manager_destroy(&lock_managers[i]);
+        for (int row = 0; row < table_stores[i].row_count; row++)
+            free(table_stores[i].rows[row]);
+        free(table_stores[i].rows);
+        btree_free(table_stores[i].index);
+
+        // Older versions were retired already, only the latest one is left
+        TableVersion *version = atomic_load(&table_versions[i]);
+        for (int row = 0; row < version->row_count; row++)
+            free(version->rows[row]);
+        free(version->rows);
+        free(version);
         free(tables[i]);
     }
     free(tables);
-    free(mutex);
-    free(write_lock);
-    free(read_count);
+    free(table_locks);
+    free(lock_managers);
+    free(table_stores);
+    if (buffer_pool_pages > 0)
+        pool_destroy(num_tables);
+    free(table_versions);
 
-    // Free memory for activities and threads
-    for (int i = 0; i < num_activities; i++)
+    // Every thread has left, so whatever is still retired can go
+    for (int i = 0; i < num_epoch_slots; i++)
     {
-        free(activities[i].written_value);
+        while (epoch_slots[i].retired_head)
+        {
+            Retired *done = epoch_slots[i].retired_head;
+            epoch_slots[i].retired_head = done->next;
+            free(done->pointer);
+            free(done);
+        }
     }
+    free(epoch_slots);
+    free(replay_timelines);
+
+    // Free memory for activities and threads
+    free(value_arena);
     free(activities);
+    free(thread_offsets);
+    free(thread_activities);
     free(threads);
     free(thread_ids);
 
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compares OCC and 2PL transactions at several contention levels.
+# Every transaction reads one key of tbl1 and one of tbl2 and writes both back;
+# fewer keys means more transactions touching the same ones.
+# Usage: ./txnBench.sh [threads] [transactions] [granularity]
+
+THREADS=${1:-16}
+TRANSACTIONS=${2:-20000}
+GRANULARITY=${3:-key}
+BINARY=./databaseSim
+WORKLOAD=txn_workload.txt
+
+# Build with the Makefile's flags; an up-to-date binary is left alone
+make -s databaseSim || exit 1
+
+printf "%-8s %-5s %10s %10s %10s %12s\n" keys mode committed aborted "abort %" "txn/s"
+for KEYS in 10000 1000 100 10; do
+    awk -v threads="$THREADS" -v transactions="$TRANSACTIONS" -v keys="$KEYS" 'BEGIN {
+        srand(42);
+        for (i = 0; i < transactions; i++) {
+            thread = 1 + i % threads;
+            a = int(rand() * keys);
+            b = int(rand() * keys);
+            print "0 " thread " 0 begin 0";
+            print "0 " thread " 1 get 0 " a;
+            print "0 " thread " 2 get 0 " b;
+            print "0 " thread " 1 put 0 " a " t" i;
+            print "0 " thread " 2 put 0 " b " t" i;
+            print "0 " thread " 0 commit 0";
+        }
+    }' > "$WORKLOAD"
+
+    for MODE in occ 2pl; do
+        START=$(date +%s.%N)
+        RESULT=$("$BINARY" --fresh --txn=$MODE --lock-granularity="$GRANULARITY" "$THREADS" 2 "$WORKLOAD" | grep Transactions)
+        END=$(date +%s.%N)
+        echo "$RESULT" | awk -v keys="$KEYS" -v mode="$MODE" -v seconds="$(echo "$END $START" | awk '{ print $1 - $2 }')" '{
+            committed = $2; aborted = $4;
+            printf "%-8s %-5s %10d %10d %10.1f %12.0f\n", keys, mode, committed, aborted,
+                100 * aborted / (committed + aborted), committed / seconds;
+        }'
+    done
+done
+rm -f "$WORKLOAD"
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Checks OCC validation against two transactions that each read what the other writes.
+# T2 reads tbl2 and writes tbl1, then waits at commit for tbl4, which thread 4 holds until 650 ms.
+# T1 reads tbl1 and writes tbl2 at 300 ms, while T2 still holds tbl1 for writing without having applied
+# anything yet. Validation must reject T1's read until T2 is done; otherwise both commit and each
+# misses the other's write (write skew).
+# A thread's activities are ordered by operation time, so every line of T1 carries its start time.
+# Usage: ./txnTest.sh
+
+BINARY=$(pwd)/databaseSim
+DIR=txn_test
+
+# Build with the Makefile's flags; an up-to-date binary is left alone
+make -s databaseSim || exit 1
+
+FAILED=0
+rm -rf "$DIR"
+mkdir "$DIR"
+cat > "$DIR/cross.txt" << EOF
+0 2 0 begin 0
+0 2 2 get 100ms 7
+0 2 1 put 0 7 t2
+0 2 4 put 0 0 t2
+0 2 0 commit 0
+50ms 4 4 put 600ms 0 blocker
+300ms 1 0 begin 0
+300ms 1 1 get 0 7
+300ms 1 2 put 0 7 t1
+300ms 1 0 commit 0
+EOF
+
+for GRANULARITY in table key; do
+    (cd "$DIR" && "$BINARY" --fresh --txn=occ --lock-granularity=$GRANULARITY 4 4 cross.txt > /dev/null)
+
+    # T1 may only write once thread 4 let go of tbl4 and T2 could finish
+    BLOCKER_END=$(grep -n "Writer 4 finished writing to tbl4.txt" "$DIR/logfile.txt" | cut -d: -f1)
+    T1_WRITE=$(grep -n "Writer 1 started writing to tbl2.txt" "$DIR/logfile.txt" | cut -d: -f1)
+    if [ -n "$BLOCKER_END" ] && [ -n "$T1_WRITE" ] && [ "$T1_WRITE" -gt "$BLOCKER_END" ] &&
+        [ "$(cat "$DIR/tbl1.kv.txt")" = "7 t2" ] && [ "$(cat "$DIR/tbl2.kv.txt")" = "7 t1" ]; then
+        echo "ok   cross read/write, $GRANULARITY locks"
+    else
+        echo "FAIL cross read/write, $GRANULARITY locks: T1 committed while T2 held its read locked"
+        FAILED=1
+    fi
+done
+
+rm -rf "$DIR"
+exit $FAILED